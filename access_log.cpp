@@ -0,0 +1,257 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "access_log.h"
+#include "clock.h"
+
+void pulsation::AccessRecord::set(int64_t time, std::string_view m, std::string_view t) {
+  time_ms = time;
+  thread_id = static_cast<uint64_t>(pthread_self());
+  method_size = std::min(m.size(), sizeof(method));
+  memcpy(method, m.data(), method_size);
+  target_size = std::min(t.size(), sizeof(target));
+  memcpy(target, t.data(), target_size);
+}
+
+pulsation::AccessLogger::AccessLogger(AccessLogOptions options): options(std::move(options)) {
+  static std::atomic<uint64_t> next_id{1};
+  id = next_id++;
+  struct stat st;
+  if (this->options.format == AccessLogFormat::BINARY && stat(this->options.path.c_str(), &st) == 0 && st.st_size > 0) {
+    // 二进制日志的路径表只在单个文件内有效，不追加到旧文件
+    rotate();
+  } else {
+    open_file();
+  }
+  writer = std::thread([this] { run(); });
+}
+
+pulsation::AccessLogger::~AccessLogger() {
+  stopping.store(true);
+  wait_cv.notify_all();
+  if (writer.joinable()) {
+    writer.join();
+  }
+  close_file();
+}
+
+pulsation::AccessRing* pulsation::AccessLogger::local_ring() {
+  // 一个线程通常只写一个logger，线性查找即可
+  thread_local std::vector<std::pair<uint64_t, AccessRing*>> local;
+  for (auto& item : local) {
+    if (item.first == id) {
+      return item.second;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  rings.emplace_back(new AccessRing());
+  local.emplace_back(id, rings.back().get());
+  return rings.back().get();
+}
+
+bool pulsation::AccessLogger::sample(AccessRing& ring, uint16_t status, uint32_t latency_us) {
+  if (status >= 400 || (options.slow_threshold_us > 0 && latency_us >= options.slow_threshold_us)) {
+    return true;
+  }
+  if (options.sample_rate > 1 && ring.sample_count++ % options.sample_rate != 0) {
+    return false;
+  }
+  if (options.max_per_second > 0) {
+    time_t now = Clock::now();
+    if (now != ring.window_second) {
+      ring.window_second = now;
+      ring.window_count = 0;
+    }
+    if (ring.window_count >= options.max_per_second) {
+      return false;
+    }
+    ring.window_count++;
+  }
+  return true;
+}
+
+void pulsation::AccessLogger::push(AccessRing& ring, const AccessRecord& record) {
+  if (!ring.push(record)) {
+    dropped_count++;
+  }
+}
+
+void pulsation::AccessLogger::log(const AccessRecord& record) {
+  AccessRing& ring = *local_ring();
+  if (sample(ring, record.status, record.latency_us)) {
+    push(ring, record);
+  }
+}
+
+void pulsation::AccessLogger::log(std::string_view method, std::string_view target, uint16_t status, uint64_t bytes, uint32_t latency_us) {
+  AccessRing& ring = *local_ring();
+  // 先决定是否采样，跳过的请求不需要拷贝记录
+  if (!sample(ring, status, latency_us)) {
+    return;
+  }
+  AccessRecord record;
+  record.set(Clock::now_ms(), method, target);
+  record.status = status;
+  record.bytes = bytes;
+  record.latency_us = latency_us;
+  push(ring, record);
+}
+
+void pulsation::AccessLogger::run() {
+  std::string buffer;
+  buffer.reserve(ACCESS_LOG_BATCH_SIZE * 2);
+  auto last_flush = std::chrono::steady_clock::now();
+  while (1) {
+    bool stop = stopping.load();
+    size_t count = drain(buffer);
+    auto now = std::chrono::steady_clock::now();
+    bool interval = now - last_flush >= std::chrono::milliseconds(options.flush_interval_ms);
+    if (buffer.size() >= ACCESS_LOG_BATCH_SIZE || (interval && (!buffer.empty() || options.format == AccessLogFormat::BINARY)) || stop) {
+      write_out(buffer);
+      last_flush = now;
+    }
+    if (stop) {
+      return;
+    }
+    if (count == 0) {
+      // 没有新记录时休眠，退出时被唤醒
+      std::unique_lock<std::mutex> lock(wait_mutex);
+      wait_cv.wait_for(lock, std::chrono::milliseconds(std::min(options.flush_interval_ms, 50)));
+    }
+  }
+}
+
+size_t pulsation::AccessLogger::drain(std::string& buffer) {
+  std::vector<AccessRing*> snapshot;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& ring : rings) {
+      snapshot.push_back(ring.get());
+    }
+  }
+  AccessRecord batch[64];
+  time_t formatted_second = -1;
+  char time_buf[32];
+  size_t time_size = 0;
+  size_t total = 0;
+  bool binary = options.format == AccessLogFormat::BINARY;
+  for (size_t index = 0; index < snapshot.size(); ++index) {
+    AccessRing* ring = snapshot[index];
+    size_t n;
+    while ((n = ring->pop(batch, 64)) > 0) {
+      total += n;
+      for (size_t i = 0; i < n; ++i) {
+        AccessRecord& r = batch[i];
+        if (binary) {
+          // 直接写入映射内存，不做格式化
+          if (!binlog.is_open()) {
+            continue;
+          }
+          if (binlog.size() >= options.max_file_size || !binlog.append(r, index)) {
+            rotate();
+            binlog.append(r, index);
+          }
+          continue;
+        }
+        time_t second = r.time_ms / 1000;
+        // 同一秒内的记录共用格式化结果
+        if (second != formatted_second) {
+          struct tm tstruct;
+          localtime_r(&second, &tstruct);
+          time_size = strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %X", &tstruct);
+          formatted_second = second;
+        }
+        char line[64];
+        buffer += "[Log] ";
+        buffer.append(time_buf, time_size);
+        int size = snprintf(line, sizeof(line), " [main - thread %llu] ", static_cast<unsigned long long>(r.thread_id));
+        buffer.append(line, size);
+        buffer.append(r.method, r.method_size);
+        buffer += ' ';
+        buffer.append(r.target, r.target_size);
+        if (r.status != 0) {
+          size = snprintf(line, sizeof(line), " %u %llu %uus", r.status, static_cast<unsigned long long>(r.bytes), r.latency_us);
+          buffer.append(line, size);
+        }
+        buffer += '\n';
+      }
+      if (buffer.size() >= ACCESS_LOG_BATCH_SIZE) {
+        write_out(buffer);
+      }
+    }
+  }
+  return total;
+}
+
+void pulsation::AccessLogger::write_out(std::string& buffer) {
+  if (options.format == AccessLogFormat::BINARY) {
+    binlog.flush();
+    return;
+  }
+  if (buffer.empty()) {
+    return;
+  }
+  if (file_size + buffer.size() > options.max_file_size && file_size > 0) {
+    rotate();
+  }
+  if (fd >= 0) {
+    size_t offset = 0;
+    while (offset < buffer.size()) {
+      ssize_t n = write(fd, buffer.data() + offset, buffer.size() - offset);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        perror("Error write access log");
+        break;
+      }
+      offset += n;
+    }
+    file_size += offset;
+  }
+  buffer.clear();
+}
+
+void pulsation::AccessLogger::open_file() {
+  if (options.format == AccessLogFormat::BINARY) {
+    if (!binlog.open(options.path, Clock::now_ms())) {
+      perror("Error open binary access log");
+    }
+    return;
+  }
+  fd = open(options.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    perror("Error open access log");
+    file_size = 0;
+    return;
+  }
+  struct stat st;
+  file_size = fstat(fd, &st) == 0 ? st.st_size : 0;
+}
+
+void pulsation::AccessLogger::close_file() {
+  binlog.close();
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+void pulsation::AccessLogger::rotate() {
+  close_file();
+  // access.log.{n-1} -> access.log.{n} ... access.log -> access.log.1
+  for (int i = options.max_files - 1; i >= 1; --i) {
+    std::string from = options.path + "." + std::to_string(i);
+    std::string to = options.path + "." + std::to_string(i + 1);
+    rename(from.c_str(), to.c_str());
+  }
+  if (options.max_files > 0) {
+    rename(options.path.c_str(), (options.path + ".1").c_str());
+  } else {
+    unlink(options.path.c_str());
+  }
+  open_file();
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+#include <string_view>
+#include <condition_variable>
+#include "binlog.h"
+#include "spsc_ring.h"
+
+namespace pulsation {
+  #define ACCESS_LOG_RING_SIZE 4096
+  #define ACCESS_LOG_BATCH_SIZE (256 * 1024)
+  #define ACCESS_LOG_TARGET_SIZE 200
+  // 定长的访问记录，worker只做拷贝，格式化由后台线程完成
+  struct AccessRecord {
+    int64_t time_ms;
+    uint64_t thread_id;
+    uint64_t bytes = 0;
+    uint32_t latency_us = 0;
+    uint16_t status = 0;
+    uint8_t method_size;
+    uint8_t target_size;
+    char method[16];
+    char target[ACCESS_LOG_TARGET_SIZE]; // 超长时截断
+
+    void set(int64_t time, std::string_view method, std::string_view target);
+  };
+  // 生产者是某个worker，消费者是后台写线程
+  class AccessRing : public SpscRing<AccessRecord, ACCESS_LOG_RING_SIZE> {
+    public:
+      // 采样状态，只由生产者线程访问，不需要原子操作
+      uint64_t sample_count = 0;
+      time_t window_second = 0;
+      uint32_t window_count = 0;
+  };
+  enum class AccessLogFormat {
+    TEXT,   // 每行一条可读文本
+    BINARY  // 定长二进制记录，写入内存映射文件，用pulsation-logcat解码
+  };
+  struct AccessLogOptions {
+    std::string path = "access.log";
+    AccessLogFormat format = AccessLogFormat::TEXT;
+    size_t max_file_size = 64 * 1024 * 1024; // 超过后轮转为path.1、path.2 ...
+    int max_files = 5;                       // 保留的历史文件数
+    int flush_interval_ms = 200;             // 未攒够一批时的最长写出间隔
+    // 采样：4xx/5xx与慢请求总是记录，其余每个线程每sample_rate条记录1条
+    uint32_t sample_rate = 1;
+    uint32_t slow_threshold_us = 0;          // 0表示不按耗时强制记录
+    uint32_t max_per_second = 0;             // 每个线程每秒最多记录的普通请求数，0表示不限
+  };
+  /**
+   * 异步访问日志。每个worker线程首次写日志时获得自己的环形队列，
+   * 写入只是一次无锁拷贝，队列满时丢弃并计数，不会阻塞请求处理；
+   * 后台线程批量格式化，攒够ACCESS_LOG_BATCH_SIZE或到达flush间隔时一次写出。
+   **/
+  class AccessLogger {
+    private:
+      AccessLogOptions options;
+      uint64_t id; // 线程本地缓存以id区分logger，地址可能被复用
+      int fd = -1;
+      size_t file_size = 0;
+      BinlogWriter binlog;
+      std::mutex mutex; // 保护rings的注册
+      std::vector<std::unique_ptr<AccessRing>> rings;
+      std::atomic<uint64_t> dropped_count{0};
+      std::atomic<bool> stopping{false};
+      std::mutex wait_mutex;
+      std::condition_variable wait_cv;
+      std::thread writer;
+
+      AccessRing* local_ring();
+      bool sample(AccessRing& ring, uint16_t status, uint32_t latency_us);
+      void push(AccessRing& ring, const AccessRecord& record);
+      void run();
+      size_t drain(std::string& buffer);
+      void write_out(std::string& buffer);
+      void open_file();
+      void close_file();
+      void rotate();
+    public:
+      AccessLogger(AccessLogOptions options = AccessLogOptions{});
+      ~AccessLogger();
+      AccessLogger(const AccessLogger&) = delete;
+      AccessLogger& operator=(const AccessLogger&) = delete;
+      void log(const AccessRecord& record);
+      void log(std::string_view method, std::string_view target, uint16_t status = 0, uint64_t bytes = 0, uint32_t latency_us = 0);
+      // 因队列满被丢弃的记录数，不含采样跳过的
+      uint64_t dropped() const { return dropped_count.load(); }
+  };
+}
@@ -0,0 +1,69 @@
+// 各content-encoding在不同级别下的压缩率与速度，只包含编译时找到的库
+// 构建：cmake -DPULSATION_BUILD_BENCH=ON，运行：./codec-bench [秒数]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "compress.h"
+
+namespace {
+  // API返回的JSON
+  std::string make_json(size_t size) {
+    std::string body = "[";
+    unsigned seed = 12345;
+    for (int i = 0; body.size() < size; ++i) {
+      seed = seed * 1103515245 + 12345;
+      body += "{\"id\":" + std::to_string(i) + ",\"name\":\"user" + std::to_string(seed % 5000) +
+        "\",\"score\":" + std::to_string(seed % 1000) + ",\"active\":" + (seed & 1 ? "true" : "false") + "},";
+    }
+    body.back() = ']';
+    return body;
+  }
+
+  // 模板渲染的HTML
+  std::string make_html(size_t size) {
+    std::string body = "<html><body><table>\n";
+    unsigned seed = 54321;
+    while (body.size() < size) {
+      seed = seed * 1103515245 + 12345;
+      body += "<tr><td class=\"item\">" + std::to_string(seed % 100000) + "</td><td>pulsation</td></tr>\n";
+    }
+    return body + "</table></body></html>\n";
+  }
+
+  void run(pulsation::Compressor* c, int level, const std::string& body, double seconds) {
+    std::string out;
+    size_t count = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < seconds) {
+      c->compress(body, out, level);
+      count++;
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    printf("  %-5s level %2d  ratio %.3f  %8.1f MB/s\n", pulsation::encoding_name(c->encoding()), level,
+      double(out.size()) / body.size(), count * body.size() / elapsed / 1e6);
+  }
+}
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+  std::vector<std::pair<const char*, std::string>> bodies = {
+    {"json 64KB", make_json(64 * 1024)}, {"json 1MB", make_json(1024 * 1024)}, {"html 64KB", make_html(64 * 1024)}
+  };
+  for (auto& body : bodies) {
+    printf("%s\n", body.first);
+    for (pulsation::Encoding encoding : {pulsation::Encoding::GZIP, pulsation::Encoding::ZSTD, pulsation::Encoding::BR}) {
+      pulsation::Compressor* c = pulsation::compressor(encoding);
+      if (c == nullptr) {
+        printf("  %-5s not built\n", pulsation::encoding_name(encoding));
+        continue;
+      }
+      for (int level : {1, c->default_level(), c->max_level()}) {
+        run(c, level, body.second, seconds);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,73 @@
+// 压缩filter吞吐量：每次初始化z_stream与线程内复用z_stream的对比
+// 构建：cmake -DPULSATION_BUILD_BENCH=ON，运行：./compress-bench [秒数]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "compress.h"
+
+namespace {
+  // 类似模板渲染结果的文本，有重复也有变化
+  std::string make_body(size_t size) {
+    std::string body;
+    unsigned seed = 12345;
+    while (body.size() < size) {
+      seed = seed * 1103515245 + 12345;
+      body += "<tr><td class=\"item\">" + std::to_string(seed % 10000) + "</td><td>pulsation</td></tr>\n";
+    }
+    body.resize(size);
+    return body;
+  }
+
+  // 修改前的做法：每次deflateInit2/deflateEnd，输出到新分配的缓冲
+  bool compress_once(const std::string& in, std::string& out) {
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      return false;
+    }
+    std::vector<char> buffer(deflateBound(&stream, in.size()));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    stream.avail_in = in.size();
+    stream.next_out = reinterpret_cast<Bytef*>(buffer.data());
+    stream.avail_out = buffer.size();
+    int err = deflate(&stream, Z_FINISH);
+    out.assign(buffer.data(), stream.total_out);
+    deflateEnd(&stream);
+    return err == Z_STREAM_END;
+  }
+
+  template<typename F>
+  void run(const char* name, const std::string& body, double seconds, F f) {
+    std::string out;
+    size_t count = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < seconds) {
+      for (int i = 0; i < 8; ++i) {
+        out = body;
+        f(out);
+        count++;
+      }
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    printf("  %-8s %10.0f req/s %9.1f MB/s  ratio %.3f\n", name, count / elapsed,
+      count * body.size() / elapsed / 1e6, double(out.size()) / body.size());
+  }
+}
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+  size_t sizes[] = {1024, 4096, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024};
+  for (size_t size : sizes) {
+    std::string body = make_body(size);
+    printf("body %zu bytes\n", size);
+    run("init", body, seconds, [](std::string& s) { compress_once(s, s); });
+    run("reuse", body, seconds, [](std::string& s) { pulsation::gzip_compress(s, s); });
+  }
+  return 0;
+}
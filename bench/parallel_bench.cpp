@@ -0,0 +1,77 @@
+// 大body并行压缩：不同线程数下的延迟与单线程gzip对比
+// 构建：cmake -DPULSATION_BUILD_BENCH=ON，运行：./parallel-bench [次数] [最大线程数，默认CPU核数]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <zlib.h>
+#include "compress.h"
+
+namespace {
+  std::string make_body(size_t size) {
+    std::string body;
+    unsigned seed = 12345;
+    while (body.size() < size) {
+      seed = seed * 1103515245 + 12345;
+      body += "<tr><td class=\"item\">" + std::to_string(seed % 100000) + "</td><td>pulsation</td></tr>\n";
+    }
+    body.resize(size);
+    return body;
+  }
+
+  // 解压校验拼接后的gzip流
+  bool verify(const std::string& compressed, const std::string& expected) {
+    z_stream stream{};
+    if (inflateInit2(&stream, MAX_WBITS + 16) != Z_OK) {
+      return false;
+    }
+    std::string out(expected.size() + 1, '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+    stream.avail_in = compressed.size();
+    stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    stream.avail_out = out.size();
+    int err = inflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    inflateEnd(&stream);
+    return err == Z_STREAM_END && out == expected;
+  }
+
+  template<typename F>
+  double measure(int rounds, F f) {
+    double best = 1e9;
+    for (int i = 0; i < rounds; ++i) {
+      auto start = std::chrono::steady_clock::now();
+      f();
+      best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+  }
+}
+
+int main(int argc, char** argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 3;
+  unsigned cores = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+  size_t sizes[] = {4 * 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024};
+  for (size_t size : sizes) {
+    std::string body = make_body(size);
+    std::string single;
+    double base = measure(rounds, [&] { pulsation::gzip_compress(body, single); });
+    printf("body %zuMB  single %8.1f ms  ratio %.3f\n", size >> 20, base, double(single.size()) / size);
+    for (unsigned threads = 1; threads <= cores; threads *= 2) {
+      pulsation::CompressPool pool(threads);
+      std::string out;
+      double ms = measure(rounds, [&] {
+        out.clear();
+        pulsation::parallel_gzip(body, [&out](std::string&& data) {
+          out += data;
+          return true;
+        }, pool);
+      });
+      printf("  threads %2u %8.1f ms  speedup %5.2fx  ratio %.3f  %s\n", threads, ms, base / ms,
+        double(out.size()) / size, verify(out, body) ? "ok" : "CORRUPT");
+    }
+  }
+  return 0;
+}
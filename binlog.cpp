@@ -0,0 +1,122 @@
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "binlog.h"
+#include "access_log.h"
+
+pulsation::BinlogWriter::~BinlogWriter() {
+  close();
+}
+
+bool pulsation::BinlogWriter::open(const std::string& path, int64_t base_time) {
+  close();
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  base_time_ms = base_time;
+  if (!reserve(sizeof(BinlogHeader))) {
+    close();
+    return false;
+  }
+  BinlogHeader header;
+  memcpy(header.magic, BINLOG_MAGIC, 4);
+  header.version = BINLOG_VERSION;
+  header.base_time_ms = base_time_ms;
+  memcpy(map, &header, sizeof(header));
+  used = sizeof(header);
+  return true;
+}
+
+bool pulsation::BinlogWriter::reserve(size_t n) {
+  if (used + n <= mapped) {
+    return true;
+  }
+  // 按块扩展文件并重新映射，未写入的部分为0，即BINLOG_END
+  size_t size = mapped + BINLOG_MAP_CHUNK;
+  if (ftruncate(fd, size) < 0) {
+    return false;
+  }
+  void* addr = map ? mremap(map, mapped, size, MREMAP_MAYMOVE) : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  map = static_cast<char*>(addr);
+  mapped = size;
+  return true;
+}
+
+uint32_t pulsation::BinlogWriter::intern(std::string_view path) {
+  auto it = paths.find(std::string(path));
+  if (it != paths.end()) {
+    return it->second;
+  }
+  if (paths.size() >= BINLOG_MAX_PATHS) {
+    return BINLOG_PATH_OVERFLOW;
+  }
+  size_t size = sizeof(BinlogPath) + ((path.size() + 7) & ~size_t(7));
+  if (!reserve(size)) {
+    return BINLOG_PATH_OVERFLOW;
+  }
+  uint32_t id = paths.size();
+  BinlogPath entry{BINLOG_PATH, 0, static_cast<uint16_t>(path.size()), id};
+  memcpy(map + used, &entry, sizeof(entry));
+  memcpy(map + used + sizeof(entry), path.data(), path.size());
+  used += size;
+  paths.emplace(std::string(path), id);
+  return id;
+}
+
+bool pulsation::BinlogWriter::append(const AccessRecord& record, uint32_t thread) {
+  int64_t delta = record.time_ms - base_time_ms;
+  if (delta < 0) {
+    delta = 0;
+  }
+  if (delta > 0xffffffffLL) {
+    return false;
+  }
+  // 只记录路径，query参数会让路径表无限增长
+  std::string_view target(record.target, record.target_size);
+  std::string_view path = target.substr(0, target.find('?'));
+  uint32_t path_id = intern(path);
+  if (!reserve(sizeof(BinlogAccess))) {
+    return true;
+  }
+  BinlogAccess entry;
+  entry.kind = BINLOG_ACCESS;
+  entry.method = binlog_method(std::string_view(record.method, record.method_size));
+  entry.status = record.status;
+  entry.time_delta_ms = static_cast<uint32_t>(delta);
+  entry.path_id = path_id;
+  entry.bytes = record.bytes > 0xffffffffULL ? 0xffffffffu : static_cast<uint32_t>(record.bytes);
+  entry.latency_us = record.latency_us;
+  entry.thread = thread;
+  memcpy(map + used, &entry, sizeof(entry));
+  used += sizeof(entry);
+  return true;
+}
+
+void pulsation::BinlogWriter::flush() {
+  if (map) {
+    msync(map, used, MS_ASYNC);
+  }
+}
+
+void pulsation::BinlogWriter::close() {
+  if (map) {
+    munmap(map, mapped);
+    map = nullptr;
+  }
+  if (fd >= 0) {
+    // 去掉预分配的空间
+    if (ftruncate(fd, used) < 0) {
+      perror("Error truncate binary log");
+    }
+    ::close(fd);
+    fd = -1;
+  }
+  mapped = 0;
+  used = 0;
+  paths.clear();
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace pulsation {
+  /**
+   * 二进制访问日志格式（本机字节序）：
+   * 文件以BinlogHeader开头，之后是8字节对齐的条目，每个条目第一个字节为类型。
+   * 路径在一个文件内首次出现时写入BINLOG_PATH条目，访问记录只引用其id，每个文件自包含。
+   * 文件按块预分配，类型为BINLOG_END(0)处即为结尾。
+   **/
+  #define BINLOG_MAGIC "PLOG"
+  #define BINLOG_VERSION 1
+  #define BINLOG_MAP_CHUNK (4 * 1024 * 1024)
+  #define BINLOG_MAX_PATHS 65536
+  #define BINLOG_PATH_OVERFLOW 0xffffffffu // 路径表已满，不再区分
+  enum BinlogKind : uint8_t {
+    BINLOG_END = 0,
+    BINLOG_ACCESS = 1,
+    BINLOG_PATH = 2
+  };
+  enum BinlogMethod : uint8_t {
+    METHOD_OTHER = 0, METHOD_GET, METHOD_HEAD, METHOD_POST, METHOD_PUT,
+    METHOD_DELETE, METHOD_OPTIONS, METHOD_PATCH, METHOD_CONNECT, METHOD_TRACE
+  };
+  inline const char* const binlog_methods[] = {
+    "OTHER", "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS", "PATCH", "CONNECT", "TRACE"
+  };
+  inline uint8_t binlog_method(std::string_view method) {
+    for (uint8_t i = 1; i < sizeof(binlog_methods) / sizeof(binlog_methods[0]); ++i) {
+      if (method == binlog_methods[i]) {
+        return i;
+      }
+    }
+    return METHOD_OTHER;
+  }
+  struct BinlogHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t base_time_ms; // 访问记录中的时间是相对它的毫秒数
+  };
+  struct BinlogAccess {
+    uint8_t kind;
+    uint8_t method;
+    uint16_t status;
+    uint32_t time_delta_ms;
+    uint32_t path_id;
+    uint32_t bytes;      // 超出时取最大值
+    uint32_t latency_us;
+    uint32_t thread;     // 写日志的worker序号
+  };
+  struct BinlogPath {
+    uint8_t kind;
+    uint8_t reserved;
+    uint16_t size;
+    uint32_t id;
+    // 之后是size字节的路径，补齐到8字节
+  };
+  static_assert(sizeof(BinlogHeader) == 16, "binlog header layout");
+  static_assert(sizeof(BinlogAccess) == 24, "binlog access layout");
+  static_assert(sizeof(BinlogPath) == 8, "binlog path layout");
+
+  struct AccessRecord;
+  // 内存映射的追加写文件，只由访问日志的后台线程使用
+  class BinlogWriter {
+    private:
+      int fd = -1;
+      char* map = nullptr;
+      size_t mapped = 0;
+      size_t used = 0;
+      int64_t base_time_ms = 0;
+      std::unordered_map<std::string, uint32_t> paths;
+
+      bool reserve(size_t n);
+      uint32_t intern(std::string_view path);
+    public:
+      ~BinlogWriter();
+      bool open(const std::string& path, int64_t base_time_ms);
+      // 时间超出可表示范围时返回false，需要轮转
+      bool append(const AccessRecord& record, uint32_t thread);
+      // 把已写入的页异步刷到磁盘
+      void flush();
+      void close();
+      size_t size() const { return used; }
+      bool is_open() const { return fd >= 0; }
+  };
+}
@@ -0,0 +1,40 @@
+#include <thread>
+#include <chrono>
+#include "clock.h"
+
+pulsation::Clock::Clock() {
+  slots[0].seconds = 0;
+  update();
+  // 首次使用时启动，之后由后台线程独自更新
+  std::thread([this] {
+    while (1) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(CLOCK_RESOLUTION_MS));
+      update();
+    }
+  }).detach();
+}
+
+pulsation::Clock& pulsation::Clock::instance() {
+  static Clock clock;
+  return clock;
+}
+
+void pulsation::Clock::update() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  milliseconds.store(int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000, std::memory_order_relaxed);
+  unsigned index = current.load(std::memory_order_relaxed);
+  if (slots[index].seconds == ts.tv_sec) {
+    return;
+  }
+  // 写入下一个槽位后再发布，正在读取旧槽位的线程不受影响
+  index = (index + 1) % CLOCK_SLOTS;
+  Slot& s = slots[index];
+  struct tm tstruct;
+  s.seconds = ts.tv_sec;
+  gmtime_r(&ts.tv_sec, &tstruct);
+  s.http_date_size = strftime(s.http_date, sizeof(s.http_date), "%a, %d %b %Y %H:%M:%S GMT", &tstruct);
+  localtime_r(&ts.tv_sec, &tstruct);
+  s.log_time_size = strftime(s.log_time, sizeof(s.log_time), "%Y-%m-%d %X", &tstruct);
+  current.store(index, std::memory_order_release);
+}
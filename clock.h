@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <ctime>
+#include <cstdint>
+#include <string_view>
+
+namespace pulsation {
+  #define CLOCK_RESOLUTION_MS 5
+  #define CLOCK_SLOTS 16
+  /**
+   * 进程级粗粒度时钟，由一个后台线程每CLOCK_RESOLUTION_MS毫秒更新一次，
+   * 秒数变化时预先格式化好Date头与日志时间，读取时不做系统调用也不加锁。
+   * 格式化结果轮流写入CLOCK_SLOTS个槽位，返回的string_view在若干秒内有效，需要保存时请拷贝。
+   **/
+  class Clock {
+    private:
+      struct Slot {
+        time_t seconds;
+        char http_date[32]; // RFC 7231: Sun, 06 Nov 1994 08:49:37 GMT
+        char log_time[32];  // 本地时间: 2019-12-21 10:00:00
+        uint8_t http_date_size;
+        uint8_t log_time_size;
+      };
+      Slot slots[CLOCK_SLOTS];
+      std::atomic<unsigned> current{0};
+      std::atomic<int64_t> milliseconds{0};
+
+      Clock();
+      void update();
+      static Clock& instance();
+      const Slot& slot() const { return slots[current.load(std::memory_order_acquire)]; }
+    public:
+      Clock(const Clock&) = delete;
+      Clock& operator=(const Clock&) = delete;
+      static time_t now() { return instance().slot().seconds; }
+      static int64_t now_ms() { return instance().milliseconds.load(std::memory_order_relaxed); }
+      static std::string_view http_date() {
+        const Slot& s = instance().slot();
+        return std::string_view(s.http_date, s.http_date_size);
+      }
+      static std::string_view log_time() {
+        const Slot& s = instance().slot();
+        return std::string_view(s.log_time, s.log_time_size);
+      }
+  };
+}
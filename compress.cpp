@@ -0,0 +1,619 @@
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <vector>
+#include <cstdlib>
+#include <boost/algorithm/string.hpp>
+#ifdef PULSATION_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef PULSATION_WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+#include "compress.h"
+#include "xxhash.h"
+
+namespace {
+  std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+      s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+      s.remove_suffix(1);
+    }
+    return s;
+  }
+
+  const std::string_view encoding_names[] = {"identity", "zstd", "br", "gzip"};
+  const char* const encoding_suffixes[] = {"", ".zst", ".br", ".gz"};
+
+  struct SlabPool {
+    std::vector<std::unique_ptr<char[]>> free[SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1];
+  };
+  thread_local SlabPool slab_pool;
+
+  // 线程内复用的deflate流，线程退出时释放
+  struct DeflateStream {
+    z_stream stream;
+    int window_bits;
+    bool ready = false;
+    int level = Z_DEFAULT_COMPRESSION;
+    explicit DeflateStream(int window_bits): window_bits(window_bits) {}
+    ~DeflateStream() {
+      if (ready) {
+        deflateEnd(&stream);
+      }
+    }
+    bool reset(int new_level) {
+      if (!ready) {
+        stream.zalloc = Z_NULL;
+        stream.zfree = Z_NULL;
+        stream.opaque = Z_NULL;
+        if (deflateInit2(&stream, new_level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+          return false;
+        }
+        ready = true;
+        level = new_level;
+        return true;
+      }
+      if (deflateReset(&stream) != Z_OK) {
+        return false;
+      }
+      if (new_level != level) {
+        if (deflateParams(&stream, new_level, Z_DEFAULT_STRATEGY) != Z_OK) {
+          return false;
+        }
+        level = new_level;
+      }
+      return true;
+    }
+  };
+  // MAX_WBITS + 16表示带gzip头与尾
+  thread_local DeflateStream gzip_stream(MAX_WBITS + 16);
+  // 并行压缩的块使用不带头尾的raw deflate
+  thread_local DeflateStream raw_stream(-MAX_WBITS);
+
+  struct CompressedBlock {
+    std::string data;
+    uLong crc;
+    bool ok;
+  };
+
+  // 以前一块末尾的32KB为字典压缩一块，不是最后一块时以Z_SYNC_FLUSH结束并对齐到字节
+  CompressedBlock compress_block(std::string_view in, size_t offset, size_t size, int level, bool last) {
+    CompressedBlock block{std::string(), crc32(0L, Z_NULL, 0), false};
+    DeflateStream& raw = raw_stream;
+    if (!raw.reset(level)) {
+      return block;
+    }
+    z_stream& stream = raw.stream;
+    if (offset > 0) {
+      size_t dict = std::min<size_t>(offset, 32 * 1024);
+      deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(in.data() + offset - dict), dict);
+    }
+    const Bytef* data = reinterpret_cast<const Bytef*>(in.data() + offset);
+    block.crc = crc32(block.crc, data, size);
+    // Z_SYNC_FLUSH额外产生一个空的stored块
+    block.data.resize(deflateBound(&stream, size) + 16);
+    stream.next_in = const_cast<Bytef*>(data);
+    stream.avail_in = size;
+    stream.next_out = reinterpret_cast<Bytef*>(&block.data[0]);
+    stream.avail_out = block.data.size();
+    int err = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    block.ok = last ? err == Z_STREAM_END : err == Z_OK && stream.avail_in == 0;
+    block.data.resize(block.data.size() - stream.avail_out);
+    return block;
+  }
+
+  class GzipCompressor : public pulsation::Compressor {
+    public:
+      pulsation::Encoding encoding() const override { return pulsation::Encoding::GZIP; }
+      int default_level() const override { return 6; }
+      int min_level() const override { return Z_BEST_SPEED; }
+      int max_level() const override { return Z_BEST_COMPRESSION; }
+      bool compress(std::string_view in, std::string& out, int level) override {
+        return pulsation::gzip_compress(in, out, level);
+      }
+  };
+
+#ifdef PULSATION_WITH_ZSTD
+  // 线程内复用的压缩上下文
+  struct ZstdContext {
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    ~ZstdContext() {
+      ZSTD_freeCCtx(cctx);
+    }
+  };
+  thread_local ZstdContext zstd_context;
+
+  class ZstdCompressor : public pulsation::Compressor {
+    public:
+      pulsation::Encoding encoding() const override { return pulsation::Encoding::ZSTD; }
+      int default_level() const override { return 3; }
+      int min_level() const override { return 1; }
+      int max_level() const override { return ZSTD_maxCLevel(); }
+      bool compress(std::string_view in, std::string& out, int level) override {
+        if (zstd_context.cctx == nullptr) {
+          return false;
+        }
+        pulsation::SlabBuffer buffer(ZSTD_compressBound(in.size()));
+        size_t n = ZSTD_compressCCtx(zstd_context.cctx, buffer.data(), buffer.size(), in.data(), in.size(), level);
+        if (ZSTD_isError(n)) {
+          return false;
+        }
+        out.assign(buffer.data(), n);
+        return true;
+      }
+  };
+#endif
+
+#ifdef PULSATION_WITH_BROTLI
+  class BrotliCompressor : public pulsation::Compressor {
+    public:
+      pulsation::Encoding encoding() const override { return pulsation::Encoding::BR; }
+      int default_level() const override { return 5; }
+      int min_level() const override { return BROTLI_MIN_QUALITY; }
+      int max_level() const override { return BROTLI_MAX_QUALITY; }
+      bool compress(std::string_view in, std::string& out, int level) override {
+        size_t bound = BrotliEncoderMaxCompressedSize(in.size());
+        if (bound == 0) {
+          return false;
+        }
+        pulsation::SlabBuffer buffer(bound);
+        size_t n = buffer.size();
+        if (!BrotliEncoderCompress(level, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, in.size(),
+            reinterpret_cast<const uint8_t*>(in.data()), &n, reinterpret_cast<uint8_t*>(buffer.data()))) {
+          return false;
+        }
+        out.assign(buffer.data(), n);
+        return true;
+      }
+  };
+#endif
+}
+
+const char* pulsation::encoding_name(Encoding encoding) {
+  return encoding_names[static_cast<int>(encoding)].data();
+}
+
+const char* pulsation::encoding_suffix(Encoding encoding) {
+  return encoding_suffixes[static_cast<int>(encoding)];
+}
+
+pulsation::Compressor* pulsation::compressor(Encoding encoding) {
+  static GzipCompressor gzip;
+#ifdef PULSATION_WITH_ZSTD
+  static ZstdCompressor zstd;
+#endif
+#ifdef PULSATION_WITH_BROTLI
+  static BrotliCompressor brotli;
+#endif
+  switch (encoding) {
+    case Encoding::GZIP:
+      return &gzip;
+#ifdef PULSATION_WITH_ZSTD
+    case Encoding::ZSTD:
+      return &zstd;
+#endif
+#ifdef PULSATION_WITH_BROTLI
+    case Encoding::BR:
+      return &brotli;
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+unsigned pulsation::runtime_encodings() {
+  static const unsigned mask = [] {
+    unsigned result = 0;
+    for (Encoding encoding : {Encoding::ZSTD, Encoding::BR, Encoding::GZIP}) {
+      if (compressor(encoding)) {
+        result |= encoding_bit(encoding);
+      }
+    }
+    return result;
+  }();
+  return mask;
+}
+
+int pulsation::CompressLevels::level(Encoding encoding) const {
+  int value = encoding == Encoding::GZIP ? gzip : encoding == Encoding::ZSTD ? zstd : encoding == Encoding::BR ? brotli : -1;
+  Compressor* c = compressor(encoding);
+  if (!c) {
+    return 0;
+  }
+  if (value < 0) {
+    return c->default_level();
+  }
+  return std::clamp(value, c->min_level(), c->max_level());
+}
+
+void pulsation::CompressLevels::clamp() {
+  int* values[] = {&gzip, &zstd, &brotli};
+  Encoding encodings[] = {Encoding::GZIP, Encoding::ZSTD, Encoding::BR};
+  for (int i = 0; i < 3; ++i) {
+    // 未编译的编码不会被协商到，保持原值
+    if (*values[i] >= 0 && compressor(encodings[i])) {
+      *values[i] = level(encodings[i]);
+    }
+  }
+}
+
+pulsation::Encoding pulsation::negotiate_encoding(std::string_view accept_encoding, unsigned available) {
+  const int count = sizeof(encoding_names) / sizeof(encoding_names[0]);
+  // -1表示没有提到，由*决定
+  double q[count];
+  for (int i = 0; i < count; ++i) {
+    q[i] = -1;
+  }
+  double any = -1;
+  while (!accept_encoding.empty()) {
+    size_t comma = accept_encoding.find(',');
+    std::string_view item = accept_encoding.substr(0, comma);
+    accept_encoding = comma == std::string_view::npos ? std::string_view() : accept_encoding.substr(comma + 1);
+    size_t semi = item.find(';');
+    std::string_view name = trim(item.substr(0, semi));
+    double value = 1;
+    if (semi != std::string_view::npos) {
+      std::string_view param = trim(item.substr(semi + 1));
+      if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+        std::string number(param.substr(2, 5));
+        value = std::strtod(number.c_str(), nullptr);
+      }
+    }
+    if (name == "*") {
+      any = value;
+      continue;
+    }
+    if (boost::algorithm::iequals(name, "x-gzip")) {
+      name = "gzip";
+    }
+    for (int i = 0; i < count; ++i) {
+      if (boost::algorithm::iequals(name, encoding_names[i])) {
+        q[i] = value;
+      }
+    }
+  }
+  int best = 0;
+  double best_q = 0;
+  for (int i = 1; i < count; ++i) {
+    if (!(available & (1u << i))) {
+      continue;
+    }
+    double value = q[i] < 0 ? any : q[i];
+    if (value > best_q) {
+      best = i;
+      best_q = value;
+    }
+  }
+  return static_cast<Encoding>(best);
+}
+
+std::string_view pulsation::mime_type(std::string_view content_type) {
+  return trim(content_type.substr(0, content_type.find(';')));
+}
+
+bool pulsation::is_precompressed_type(std::string_view mime) {
+  static const std::string_view prefixes[] = {"video/", "audio/"};
+  static const std::string_view types[] = {
+    "image/jpeg", "image/png", "image/gif", "image/webp", "image/avif",
+    "application/zip", "application/gzip", "application/x-gzip", "application/zstd",
+    "application/x-7z-compressed", "application/x-rar-compressed", "application/pdf",
+    "font/woff", "font/woff2"
+  };
+  for (std::string_view prefix : prefixes) {
+    if (mime.substr(0, prefix.size()) == prefix) {
+      return true;
+    }
+  }
+  for (std::string_view type : types) {
+    if (boost::algorithm::iequals(mime, type)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool pulsation::looks_compressible(std::string_view body) {
+  size_t n = std::min<size_t>(body.size(), COMPRESS_SAMPLE_SIZE);
+  if (n == 0) {
+    return false;
+  }
+  size_t histogram[256] = {0};
+  for (size_t i = 0; i < n; ++i) {
+    histogram[static_cast<unsigned char>(body[i])]++;
+  }
+  double entropy = 0;
+  for (size_t count : histogram) {
+    if (count > 0) {
+      double p = static_cast<double>(count) / n;
+      entropy -= p * std::log2(p);
+    }
+  }
+  return entropy < COMPRESS_MAX_ENTROPY;
+}
+
+void pulsation::add_vary(std::unordered_map<std::string, std::string>& headers, std::string_view field) {
+  auto it = headers.find("vary");
+  if (it == headers.end()) {
+    headers.emplace("vary", std::string(field));
+    return;
+  }
+  std::string_view value = it->second;
+  while (!value.empty()) {
+    size_t comma = value.find(',');
+    std::string_view item = trim(value.substr(0, comma));
+    if (item == "*" || boost::algorithm::iequals(item, field)) {
+      return;
+    }
+    value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+  }
+  it->second += ", ";
+  it->second += field;
+}
+
+void pulsation::weaken_etag(std::unordered_map<std::string, std::string>& headers) {
+  auto it = headers.find("etag");
+  if (it != headers.end() && it->second.compare(0, 2, "W/") != 0) {
+    it->second.insert(0, "W/");
+  }
+}
+
+pulsation::SlabBuffer::SlabBuffer(size_t size) {
+  int shift = SLAB_MIN_SHIFT;
+  while (shift <= SLAB_MAX_SHIFT && (size_t(1) << shift) < size) {
+    shift++;
+  }
+  if (shift > SLAB_MAX_SHIFT) {
+    buffer = new char[size];
+    capacity = size;
+    slab_class = -1;
+    return;
+  }
+  slab_class = shift - SLAB_MIN_SHIFT;
+  capacity = size_t(1) << shift;
+  auto& free = slab_pool.free[slab_class];
+  if (free.empty()) {
+    buffer = new char[capacity];
+  } else {
+    buffer = free.back().release();
+    free.pop_back();
+  }
+}
+
+pulsation::SlabBuffer::~SlabBuffer() {
+  if (slab_class >= 0 && slab_pool.free[slab_class].size() < SLAB_CACHED_PER_CLASS) {
+    slab_pool.free[slab_class].emplace_back(buffer);
+    return;
+  }
+  delete[] buffer;
+}
+
+bool pulsation::gzip_compress(std::string_view in, std::string& out, int level) {
+  DeflateStream& gz = gzip_stream;
+  if (!gz.reset(level)) {
+    return false;
+  }
+  z_stream& stream = gz.stream;
+  // deflateBound包含gzip头尾，一次Z_FINISH即可完成
+  SlabBuffer buffer(deflateBound(&stream, in.size()));
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+  stream.avail_in = in.size();
+  stream.next_out = reinterpret_cast<Bytef*>(buffer.data());
+  stream.avail_out = buffer.size();
+  if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+    return false;
+  }
+  out.assign(buffer.data(), stream.total_out);
+  return true;
+}
+
+pulsation::CompressCache::CompressCache(size_t max_bytes): shard_capacity(max_bytes / COMPRESS_CACHE_SHARDS) {}
+
+bool pulsation::CompressCache::compress(std::string_view in, std::string& out, Encoding encoding, int level) {
+  Compressor* c = compressor(encoding);
+  if (c == nullptr) {
+    return false;
+  }
+  if (in.size() > COMPRESS_CACHE_MAX_ENTRY) {
+    return c->compress(in, out, level);
+  }
+  Key key{xxhash64(in.data(), in.size()), in.size(), encoding, level};
+  Shard& shard = shards[key.hash % COMPRESS_CACHE_SHARDS];
+  std::shared_ptr<const std::string> data;
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+      data = it->second->data;
+    }
+  }
+  if (data) {
+    hit_count++;
+    out.assign(*data);
+    return true;
+  }
+  miss_count++;
+  // 压缩在锁外进行，并发的相同请求可能各自压缩一次，后写入的覆盖前者
+  if (!c->compress(in, out, level)) {
+    return false;
+  }
+  if (out.size() > shard_capacity) {
+    return true;
+  }
+  data = std::make_shared<const std::string>(out);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    shard.bytes -= it->second->data->size();
+    shard.entries.erase(it->second);
+    shard.index.erase(it);
+  }
+  while (!shard.entries.empty() && shard.bytes + data->size() > shard_capacity) {
+    Entry& last = shard.entries.back();
+    shard.bytes -= last.data->size();
+    shard.index.erase(last.key);
+    shard.entries.pop_back();
+    eviction_count++;
+  }
+  shard.entries.push_front(Entry{key, data});
+  shard.index.emplace(key, shard.entries.begin());
+  shard.bytes += data->size();
+  return true;
+}
+
+pulsation::CompressCacheStats pulsation::CompressCache::stats() {
+  CompressCacheStats result{hit_count.load(), miss_count.load(), eviction_count.load(), 0, 0};
+  for (Shard& shard : shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    result.entries += shard.index.size();
+    result.bytes += shard.bytes;
+  }
+  return result;
+}
+
+pulsation::GzipStreamEncoder::GzipStreamEncoder(int level, size_t flush_bytes): flush_bytes(flush_bytes) {
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  ready = deflateInit2(&stream, level, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+pulsation::GzipStreamEncoder::~GzipStreamEncoder() {
+  if (ready) {
+    deflateEnd(&stream);
+  }
+}
+
+std::string pulsation::GzipStreamEncoder::encode(std::string_view data, bool last) {
+  std::string out;
+  if (!ready || finished) {
+    return out;
+  }
+  unflushed += data.size();
+  int flush = Z_NO_FLUSH;
+  if (last) {
+    flush = Z_FINISH;
+  } else if (unflushed > 0 && unflushed >= flush_bytes) {
+    flush = Z_SYNC_FLUSH;
+  } else if (data.empty()) {
+    return out;
+  }
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  // 输出区用完说明还有数据，直到zlib不再填满输出区为止
+  size_t used = 0;
+  do {
+    out.resize(used + std::max<size_t>(data.size() / 2, 16 * 1024));
+    stream.next_out = reinterpret_cast<Bytef*>(&out[used]);
+    stream.avail_out = out.size() - used;
+    int err = deflate(&stream, flush);
+    used = out.size() - stream.avail_out;
+    if (err == Z_STREAM_END) {
+      finished = true;
+      break;
+    }
+    if (err != Z_OK && err != Z_BUF_ERROR) {
+      break;
+    }
+  } while (stream.avail_out == 0);
+  out.resize(used);
+  if (flush != Z_NO_FLUSH) {
+    unflushed = 0;
+  }
+  return out;
+}
+
+pulsation::CompressPool::CompressPool(unsigned count) {
+  for (unsigned i = 0; i < std::max(count, 1u); ++i) {
+    threads.emplace_back([this] {
+      while (1) {
+        std::function<void()> task;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+          if (tasks.empty()) {
+            return;
+          }
+          task = std::move(tasks.front());
+          tasks.pop_front();
+        }
+        task();
+      }
+    });
+  }
+}
+
+pulsation::CompressPool::~CompressPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cv.notify_all();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+void pulsation::CompressPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(std::move(task));
+  }
+  cv.notify_one();
+}
+
+pulsation::CompressPool& pulsation::CompressPool::shared() {
+  static CompressPool pool(std::thread::hardware_concurrency());
+  return pool;
+}
+
+bool pulsation::parallel_gzip(std::string_view in, const std::function<bool(std::string&&)>& emit, CompressPool& pool, int level, size_t block_size) {
+  size_t count = std::max<size_t>((in.size() + block_size - 1) / block_size, 1);
+  // 限制同时在途的块数，内存占用与body大小无关
+  size_t window = pool.size() * 2;
+  std::vector<std::future<CompressedBlock>> blocks(count);
+  size_t submitted = 0;
+  auto submit_until = [&](size_t end) {
+    for (; submitted < std::min(end, count); ++submitted) {
+      size_t offset = submitted * block_size;
+      size_t size = std::min(block_size, in.size() - offset);
+      bool last = submitted == count - 1;
+      auto promise = std::make_shared<std::promise<CompressedBlock>>();
+      blocks[submitted] = promise->get_future();
+      pool.submit([promise, in, offset, size, level, last] {
+        promise->set_value(compress_block(in, offset, size, level, last));
+      });
+    }
+  };
+  submit_until(window);
+  // gzip头：无文件名与时间，OS为Unix
+  static const char header[10] = {'\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, 3};
+  bool ok = emit(std::string(header, sizeof(header)));
+  uLong crc = crc32(0L, Z_NULL, 0);
+  size_t next = 0;
+  for (; ok && next < count; ++next) {
+    CompressedBlock block = blocks[next].get();
+    submit_until(next + 1 + window);
+    size_t size = std::min(block_size, in.size() - next * block_size);
+    crc = crc32_combine(crc, block.crc, size);
+    ok = block.ok && emit(std::move(block.data));
+  }
+  // 中止时等待已提交的块，它们仍在引用in
+  for (; next < submitted; ++next) {
+    blocks[next].wait();
+  }
+  if (!ok) {
+    return false;
+  }
+  std::string trailer(8, '\0');
+  uint32_t isize = static_cast<uint32_t>(in.size());
+  for (int i = 0; i < 4; ++i) {
+    trailer[i] = static_cast<char>((crc >> (8 * i)) & 0xff);
+    trailer[4 + i] = static_cast<char>((isize >> (8 * i)) & 0xff);
+  }
+  return emit(std::move(trailer));
+}
@@ -0,0 +1,197 @@
+#pragma once
+#include <list>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include <string_view>
+#include <unordered_map>
+#include <zlib.h>
+
+namespace pulsation {
+  #define COMPRESS_MIN_SIZE 1024    // 小于该长度的body压缩收益不抵开销
+  #define COMPRESS_SAMPLE_SIZE 4096 // 判断未知类型是否可压缩时的采样长度
+  #define COMPRESS_MAX_ENTROPY 7.0  // 采样的字节熵（bit/byte）超过该值时视为已压缩数据
+  #define SLAB_MIN_SHIFT 14         // 输出缓冲最小16KB
+  #define SLAB_MAX_SHIFT 24         // 超过16MB的缓冲不进入池
+  #define SLAB_CACHED_PER_CLASS 2   // 每个线程每种大小最多缓存的空闲缓冲数
+  #define COMPRESS_CACHE_SHARDS 16
+  #define COMPRESS_CACHE_BYTES (64 * 1024 * 1024)
+  #define COMPRESS_CACHE_MAX_ENTRY (1024 * 1024) // 超过该长度的body不缓存
+  #define COMPRESS_STREAM_THRESHOLD (1024 * 1024) // 超过该长度的body改为分段压缩并以chunked发送
+  #define COMPRESS_STREAM_BLOCK (64 * 1024)       // 分段压缩时每次送入的数据量
+  #define COMPRESS_PARALLEL_THRESHOLD (4 * 1024 * 1024) // 超过该长度的body在线程池中并行压缩
+  #define COMPRESS_PARALLEL_BLOCK (128 * 1024)
+  // 按服务端偏好排列，q值相同时取靠前者
+  enum class Encoding { IDENTITY = 0, ZSTD, BR, GZIP };
+  inline constexpr unsigned encoding_bit(Encoding encoding) { return 1u << static_cast<int>(encoding); }
+  // 运行时能够压缩的编码（encoding_bit的组合），取决于编译时找到的库
+  unsigned runtime_encodings();
+  const char* encoding_name(Encoding encoding);
+  // 预压缩旁路文件的后缀，如index.html.gz
+  const char* encoding_suffix(Encoding encoding);
+  /**
+   * 按Accept-Encoding的q值在available（encoding_bit的组合）中协商编码，支持*与x-gzip，q=0表示拒绝。
+   * 没有可用的编码时返回IDENTITY（即使客户端写了identity;q=0，也不返回406）
+   **/
+  Encoding negotiate_encoding(std::string_view accept_encoding, unsigned available = runtime_encodings());
+  // 去掉content-type的参数部分，如"text/html; charset=utf-8" -> "text/html"
+  std::string_view mime_type(std::string_view content_type);
+  // 图片、音视频、压缩包等自身已压缩的类型
+  bool is_precompressed_type(std::string_view mime);
+  // 对body开头采样估计字节熵，用于未在配置中列出的类型
+  bool looks_compressible(std::string_view body);
+  // 向Vary追加字段，已存在时不重复
+  void add_vary(std::unordered_map<std::string, std::string>& headers, std::string_view field);
+  // 施加content-encoding后body与原内容不再逐字节相同，强ETag改为弱ETag（与nginx的gzip相同），If-None-Match的弱比较不受影响
+  void weaken_etag(std::unordered_map<std::string, std::string>& headers);
+
+  // 一种content-encoding的实现，CMake检测到对应的库时才编译zstd与brotli
+  class Compressor {
+    public:
+      virtual ~Compressor() = default;
+      virtual Encoding encoding() const = 0;
+      // 各编码的级别范围不同：gzip 1-9，zstd 1-22，brotli 0-11
+      virtual int default_level() const = 0;
+      virtual int min_level() const = 0;
+      virtual int max_level() const = 0;
+      // in与out可以是同一个字符串，失败时out不变
+      virtual bool compress(std::string_view in, std::string& out, int level) = 0;
+  };
+  // 未编译该编码时返回nullptr；实现只使用线程内状态，可以多线程共用
+  Compressor* compressor(Encoding encoding);
+  // 按编码分别设置的压缩级别，小于0时使用该编码的默认级别，超出该编码的范围时取最近的有效级别
+  struct CompressLevels {
+    int gzip = -1;
+    int zstd = -1;
+    int brotli = -1;
+    int level(Encoding encoding) const;
+    // 将已设置的级别限制到各编码的范围内，配置时调用一次
+    void clamp();
+  };
+
+  /**
+   * 按2的幂分级的线程内缓冲池，压缩的输出先写到这里，再拷回response.body，
+   * 拷回时复用body原有的容量，一次压缩不再产生与body大小相关的堆分配
+   **/
+  class SlabBuffer {
+    private:
+      char* buffer;
+      size_t capacity;
+      int slab_class; // 不属于池时为-1
+    public:
+      explicit SlabBuffer(size_t size);
+      ~SlabBuffer();
+      SlabBuffer(const SlabBuffer&) = delete;
+      SlabBuffer& operator=(const SlabBuffer&) = delete;
+      char* data() { return buffer; }
+      size_t size() const { return capacity; }
+  };
+  /**
+   * 用当前线程复用的z_stream压缩为gzip格式，每次只做deflateReset，
+   * 不再为每个响应初始化与释放约256KB的zlib状态。in与out可以是同一个字符串，失败时out不变
+   **/
+  bool gzip_compress(std::string_view in, std::string& out, int level = Z_DEFAULT_COMPRESSION);
+
+  /**
+   * 增量gzip压缩，用于流式响应与超大body：输出按段产生，内存占用与body总长无关。
+   * 累计输入达到flush_bytes时以Z_SYNC_FLUSH输出，客户端可以立即解压已收到的部分；
+   * flush_bytes为0时每段都刷新，适合逐条产生数据的流
+   **/
+  class GzipStreamEncoder {
+    private:
+      z_stream stream;
+      bool ready = false;
+      bool finished = false;
+      size_t flush_bytes;
+      size_t unflushed = 0;
+    public:
+      explicit GzipStreamEncoder(int level = Z_DEFAULT_COMPRESSION, size_t flush_bytes = 0);
+      ~GzipStreamEncoder();
+      GzipStreamEncoder(const GzipStreamEncoder&) = delete;
+      GzipStreamEncoder& operator=(const GzipStreamEncoder&) = delete;
+      bool ok() const { return ready; }
+      // 压缩一段数据，返回目前可以发出的压缩数据（可能为空）；last为true时结束gzip流
+      std::string encode(std::string_view data, bool last);
+  };
+  // 并行压缩大body的辅助线程池
+  class CompressPool {
+    private:
+      std::mutex mutex;
+      std::condition_variable cv;
+      std::deque<std::function<void()>> tasks;
+      std::vector<std::thread> threads;
+      bool stopping = false;
+    public:
+      explicit CompressPool(unsigned count);
+      ~CompressPool();
+      CompressPool(const CompressPool&) = delete;
+      CompressPool& operator=(const CompressPool&) = delete;
+      void submit(std::function<void()> task);
+      size_t size() const { return threads.size(); }
+      // 进程共享，线程数为CPU核数
+      static CompressPool& shared();
+  };
+  /**
+   * pigz式并行gzip：按block_size切块，每块以前一块末尾32KB为字典在线程池中独立压缩，
+   * 非最后一块以Z_SYNC_FLUSH对齐到字节，按顺序拼接成一个gzip流，crc32由crc32_combine合并。
+   * 输出（gzip头、各块、尾）按顺序交给emit，emit返回false或压缩失败时中止并返回false
+   **/
+  bool parallel_gzip(std::string_view in, const std::function<bool(std::string&&)>& emit,
+    CompressPool& pool = CompressPool::shared(), int level = Z_DEFAULT_COMPRESSION, size_t block_size = COMPRESS_PARALLEL_BLOCK);
+  struct CompressCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t entries;
+    uint64_t bytes;
+  };
+  /**
+   * 压缩结果缓存，key为未压缩body的xxHash64、长度、编码与级别，不保存原文，
+   * 64位哈希加长度相同而内容不同的概率可以忽略。
+   * 按key分片，每个分片一把锁与一条LRU，容量按压缩后的字节数计算。
+   **/
+  class CompressCache {
+    private:
+      struct Key {
+        uint64_t hash;
+        uint64_t size;
+        Encoding encoding;
+        int level;
+        bool operator==(const Key& other) const {
+          return hash == other.hash && size == other.size && encoding == other.encoding && level == other.level;
+        }
+      };
+      struct KeyHash {
+        size_t operator()(const Key& key) const { return key.hash ^ static_cast<size_t>(key.encoding); }
+      };
+      struct Entry {
+        Key key;
+        std::shared_ptr<const std::string> data;
+      };
+      struct Shard {
+        std::mutex mutex;
+        std::list<Entry> entries; // 最近使用的在前
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+        size_t bytes = 0;
+      };
+      Shard shards[COMPRESS_CACHE_SHARDS];
+      size_t shard_capacity;
+      std::atomic<uint64_t> hit_count{0};
+      std::atomic<uint64_t> miss_count{0};
+      std::atomic<uint64_t> eviction_count{0};
+    public:
+      explicit CompressCache(size_t max_bytes = COMPRESS_CACHE_BYTES);
+      /**
+       * 压缩in并写入out，命中时直接拷贝缓存的结果，不再压缩。in与out可以是同一个字符串。
+       * 未编译的编码或压缩失败时返回false，out不变
+       **/
+      bool compress(std::string_view in, std::string& out, Encoding encoding, int level);
+      CompressCacheStats stats();
+  };
+}
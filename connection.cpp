@@ -0,0 +1,46 @@
+#include <unistd.h>
+#include <cstdint>
+#include "connection.h"
+
+void pulsation::Channel::send(Message msg) {
+  queue.enqueue(std::move(msg));
+  // 只在IO线程取完上一批消息后唤醒一次
+  if (!armed.exchange(true)) {
+    uint64_t one = 1;
+    write(event_fd, &one, sizeof(one));
+  }
+}
+
+void pulsation::Channel::reset() {
+  uint64_t count;
+  read(event_fd, &count, sizeof(count));
+  armed.store(false);
+}
+
+void pulsation::Connection::send(uint64_t seq, Slice data, bool last, bool close, uint8_t type) {
+  pending += data.size;
+  channel->send(Message{shared_from_this(), seq, std::move(data), last, close, type});
+}
+
+bool pulsation::Connection::wait_writable() {
+  if (pending.load() < HIGH_WATER_MARK) {
+    return !closed.load();
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [this]{ return pending.load() < HIGH_WATER_MARK || closed.load(); });
+  return !closed.load();
+}
+
+void pulsation::Connection::consumed(size_t n) {
+  size_t before = pending.fetch_sub(n);
+  if (before >= LOW_WATER_MARK && before - n < LOW_WATER_MARK) {
+    std::lock_guard<std::mutex> lock(mutex);
+    cv.notify_all();
+  }
+}
+
+void pulsation::Connection::mark_closed() {
+  closed.store(true);
+  std::lock_guard<std::mutex> lock(mutex);
+  cv.notify_all();
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <condition_variable>
+#include "concurrentqueue.h"
+
+namespace pulsation {
+  #define HIGH_WATER_MARK (1024 * 1024)
+  #define LOW_WATER_MARK (256 * 1024)
+  // 引用计数的只读数据片段，同一份数据可以同时挂在多个连接的发送队列上
+  struct Slice {
+    std::shared_ptr<const void> owner;
+    const char* data;
+    size_t size;
+  };
+  inline Slice make_slice(std::string s) {
+    auto owner = std::make_shared<const std::string>(std::move(s));
+    return Slice{owner, owner->data(), owner->size()};
+  }
+
+  struct Connection;
+  class WebSocket;
+  class EventTopic;
+  enum MessageType : uint8_t {
+    MSG_RAW = 0,    // HTTP/1.x 已序列化的数据
+    MSG_H2_HEADERS, // HTTP/2 HPACK编码后的响应头
+    MSG_H2_DATA,    // HTTP/2 响应body
+    MSG_H2_RESET,   // HTTP/2 中止流
+    MSG_WS_ACCEPT,  // WebSocket 101响应，写出后连接切换为WebSocket
+    MSG_WS_FRAME,   // WebSocket 已序列化的帧
+    MSG_WS_CLOSE,   // WebSocket 关闭帧
+    MSG_SSE_OPEN    // SSE 响应头已发出，登记订阅
+  };
+  // worker交给IO线程写出的数据
+  struct Message {
+    std::shared_ptr<Connection> conn;
+    uint64_t seq;  // 所属请求在连接上的序号（HTTP/2为stream id），IO线程按序号顺序写出
+    Slice data;
+    bool last;     // 该请求的响应已完整
+    bool close;    // 写完后关闭连接
+    uint8_t type;
+  };
+
+  // 每个IO线程一个，worker通过它把数据交回拥有该连接的IO线程
+  struct Channel {
+    int event_fd;
+    std::atomic<bool> armed{false};
+    moodycamel::ConcurrentQueue<Message> queue;
+    void send(Message msg);
+    // IO线程在取消息前调用，之后的send会重新唤醒epoll
+    void reset();
+  };
+
+  // IO线程与worker共享的连接状态，socket只由IO线程读写
+  struct Connection : std::enable_shared_from_this<Connection> {
+    int fd;
+    Channel* channel;
+    std::atomic<size_t> pending{0}; // 已提交但尚未写出的字节数，不含暂存在重排缓冲中的后续响应
+    std::atomic<bool> closed{false};
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::shared_ptr<WebSocket> websocket; // worker同意升级时设置，IO线程处理或丢弃MSG_WS_ACCEPT时取走
+    // worker登记的SSE订阅，由mutex保护，IO线程收到MSG_SSE_OPEN时生效
+    std::vector<std::pair<uint64_t, std::shared_ptr<EventTopic>>> subscriptions;
+
+    Connection(int fd, Channel* channel): fd(fd), channel(channel) {}
+    void send(uint64_t seq, Slice data, bool last, bool close = false, uint8_t type = MSG_RAW);
+    // 发送队列超过高水位时阻塞，直到IO线程写到低水位以下，连接关闭时返回false
+    bool wait_writable();
+    // IO线程写出数据后调用
+    void consumed(size_t n);
+    void mark_closed();
+  };
+}
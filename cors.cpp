@@ -0,0 +1,249 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <boost/algorithm/string.hpp>
+#include "cors.h"
+#include "clock.h"
+
+namespace {
+  // 拆分为scheme、host与port，port缺省时为空
+  bool split_origin(std::string_view origin, std::string_view& scheme, std::string_view& host, std::string_view& port) {
+    size_t pos = origin.find("://");
+    if (pos == std::string_view::npos || pos == 0) {
+      return false;
+    }
+    scheme = origin.substr(0, pos);
+    std::string_view rest = origin.substr(pos + 3);
+    if (rest.empty()) {
+      return false;
+    }
+    size_t host_end = rest.front() == '[' ? rest.find(']') : 0;
+    if (host_end == std::string_view::npos) {
+      return false;
+    }
+    size_t colon = rest.find(':', host_end);
+    host = rest.substr(0, colon);
+    port = colon == std::string_view::npos ? std::string_view() : rest.substr(colon + 1);
+    return !host.empty();
+  }
+
+  // 比较用的origin：scheme与host不区分大小写，去掉scheme的默认端口
+  std::string normalize_origin(std::string_view origin) {
+    std::string normalized = boost::algorithm::to_lower_copy(std::string(origin));
+    std::string_view scheme, host, port;
+    if (split_origin(normalized, scheme, host, port) &&
+        ((scheme == "http" && port == "80") || (scheme == "https" && port == "443"))) {
+      normalized.resize(port.data() - normalized.data() - 1);
+    }
+    return normalized;
+  }
+
+  std::string wildcard_key(std::string_view scheme, std::string_view port) {
+    std::string key(scheme);
+    key += ':';
+    key.append(port.data(), port.size());
+    return key;
+  }
+}
+
+pulsation::CorsPolicy::CorsPolicy(const CorsOptions& options): has_credentials(options.credentials) {
+  static std::atomic<uint64_t> next_id{1};
+  id = next_id++;
+  alive = std::make_shared<char>();
+  for (const std::string& item : options.origins) {
+    std::string origin = normalize_origin(item);
+    if (origin == "*") {
+      any_origin = true;
+      continue;
+    }
+    std::string_view scheme, host, port;
+    if (split_origin(origin, scheme, host, port) && host.substr(0, 2) == "*.") {
+      Node* node = &wildcard_roots[wildcard_key(scheme, port)];
+      std::string_view domain = host.substr(2);
+      // 从顶级域名开始插入
+      while (!domain.empty()) {
+        size_t dot = domain.rfind('.');
+        std::string_view label = dot == std::string_view::npos ? domain : domain.substr(dot + 1);
+        domain = dot == std::string_view::npos ? std::string_view() : domain.substr(0, dot);
+        auto it = node->children.find(label);
+        if (it == node->children.end()) {
+          it = node->children.emplace(std::string(label), std::make_unique<Node>()).first;
+        }
+        node = it->second.get();
+      }
+      node->wildcard = true;
+      continue;
+    }
+    exact.insert(origin);
+  }
+  if (any_origin && has_credentials) {
+    // 回显任意origin并允许凭证，任何网站都能带着用户的cookie跨域读取响应
+    fprintf(stderr, "CORS: credentials cannot be allowed for origin \"*\", list the allowed origins explicitly\n");
+    exit(1);
+  }
+  methods_value = boost::algorithm::join(options.allow_methods, ",");
+  headers_value = boost::algorithm::join(options.allow_headers, ",");
+  expose_value = boost::algorithm::join(options.expose_headers, ",");
+  if (options.max_age >= 0) {
+    max_age_value = std::to_string(options.max_age);
+  }
+}
+
+bool pulsation::CorsPolicy::match_wildcard(std::string_view origin) const {
+  std::string_view scheme, host, port;
+  if (wildcard_roots.empty() || !split_origin(origin, scheme, host, port)) {
+    return false;
+  }
+  auto root = wildcard_roots.find(wildcard_key(scheme, port));
+  if (root == wildcard_roots.end()) {
+    return false;
+  }
+  const Node* node = &root->second;
+  std::string_view domain = host;
+  while (!domain.empty()) {
+    size_t dot = domain.rfind('.');
+    std::string_view label = dot == std::string_view::npos ? domain : domain.substr(dot + 1);
+    domain = dot == std::string_view::npos ? std::string_view() : domain.substr(0, dot);
+    auto it = node->children.find(label);
+    if (it == node->children.end()) {
+      return false;
+    }
+    node = it->second.get();
+    // 通配只匹配更深一级及以上的子域名
+    if (node->wildcard && !domain.empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const std::string* pulsation::CorsPolicy::allow_origin(const std::string& origin) const {
+  if (any_origin) {
+    return &star;
+  }
+  if (exact.find(origin) != exact.end()) {
+    return &origin;
+  }
+  // 允许时回显请求中原样的origin，浏览器按原样比较
+  std::string normalized = normalize_origin(origin);
+  if (exact.find(normalized) != exact.end() || match_wildcard(normalized)) {
+    return &origin;
+  }
+  return nullptr;
+}
+
+bool pulsation::CorsPolicy::preflight_headers(const HTTPRequest& req, std::vector<std::pair<std::string, std::string>>& headers) const {
+  auto origin_it = req.headers.find("origin");
+  if (req.method != "OPTIONS" || origin_it == req.headers.end() ||
+      req.headers.find("access-control-request-method") == req.headers.end()) {
+    return false;
+  }
+  const std::string* origin = allow_origin(origin_it->second);
+  if (origin == nullptr) {
+    return false;
+  }
+  headers.emplace_back("access-control-allow-origin", *origin);
+  if (origin == &origin_it->second) {
+    headers.emplace_back("vary", "Origin");
+  }
+  if (has_credentials) {
+    headers.emplace_back("access-control-allow-credentials", "true");
+  }
+  if (!max_age_value.empty()) {
+    headers.emplace_back("access-control-max-age", max_age_value);
+  }
+  if (!methods_value.empty()) {
+    headers.emplace_back("access-control-allow-methods", methods_value);
+  }
+  if (!headers_value.empty()) {
+    headers.emplace_back("access-control-allow-headers", headers_value);
+  } else {
+    auto request_headers = req.headers.find("access-control-request-headers");
+    if (request_headers != req.headers.end()) {
+      headers.emplace_back("access-control-allow-headers", request_headers->second);
+    }
+  }
+  return true;
+}
+
+pulsation::CorsPolicy::PreflightCache& pulsation::CorsPolicy::local_cache() const {
+  thread_local std::vector<LocalCache> local;
+  PreflightCache* found = nullptr;
+  for (auto it = local.begin(); it != local.end();) {
+    // 顺便释放已销毁的policy在本线程留下的缓存
+    if (it->alive.expired()) {
+      it = local.erase(it);
+      continue;
+    }
+    if (it->id == id) {
+      found = it->cache.get();
+    }
+    ++it;
+  }
+  if (!found) {
+    local.push_back(LocalCache{id, alive, std::make_unique<PreflightCache>()});
+    found = local.back().cache.get();
+  }
+  return *found;
+}
+
+pulsation::Slice pulsation::CorsPolicy::preflight(const HTTPRequest& req) const {
+  // HTTP/1.0与要求关闭的连接走filter链，由worker决定连接的去留
+  if (req.method != "OPTIONS" || req.protocal != "HTTP/1.1") {
+    return Slice{};
+  }
+  auto connection = req.headers.find("connection");
+  if (connection != req.headers.end() && boost::algorithm::iequals(connection->second, "close")) {
+    return Slice{};
+  }
+  auto origin = req.headers.find("origin");
+  auto method = req.headers.find("access-control-request-method");
+  if (origin == req.headers.end() || method == req.headers.end()) {
+    return Slice{};
+  }
+  auto request_headers = req.headers.find("access-control-request-headers");
+  std::string key = origin->second;
+  key += '\0';
+  key += method->second;
+  key += '\0';
+  if (request_headers != req.headers.end()) {
+    key += request_headers->second;
+  }
+  PreflightCache& cache = local_cache();
+  auto it = cache.index.find(key);
+  if (it != cache.index.end()) {
+    cache.entries.splice(cache.entries.begin(), cache.entries, it->second);
+  } else {
+    std::vector<std::pair<std::string, std::string>> headers;
+    if (!preflight_headers(req, headers)) {
+      return Slice{};
+    }
+    PreflightEntry entry;
+    entry.key = std::move(key);
+    entry.head = "HTTP/1.1 204 No Content\r\nserver: pulsation\r\n";
+    for (auto& header : headers) {
+      entry.head += header.first + ": " + header.second + "\r\n";
+    }
+    entry.head += "content-length: 0\r\n";
+    if (cache.entries.size() >= CORS_PREFLIGHT_CACHE_SIZE) {
+      cache.index.erase(cache.entries.back().key);
+      cache.entries.pop_back();
+    }
+    cache.entries.push_front(std::move(entry));
+    cache.index.emplace(cache.entries.front().key, cache.entries.begin());
+  }
+  PreflightEntry& entry = cache.entries.front();
+  time_t now = Clock::now();
+  if (entry.second != now) {
+    std::string_view date = Clock::http_date();
+    std::string response;
+    response.reserve(entry.head.size() + date.size() + 12);
+    response += entry.head;
+    response += "date: ";
+    response += date;
+    response += "\r\n\r\n";
+    entry.response = make_slice(std::move(response));
+    entry.second = now;
+  }
+  return entry.response;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <map>
+#include <list>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "http.h"
+
+namespace pulsation {
+  #define CORS_PREFLIGHT_CACHE_SIZE 1024
+  struct CorsOptions {
+    // 完整的origin（https://example.com）、通配子域名（https://*.example.com）或"*"，
+    // scheme与host不区分大小写，默认端口（http 80、https 443）与省略端口等价
+    std::vector<std::string> origins = {"*"};
+    std::vector<std::string> allow_methods;
+    std::vector<std::string> allow_headers; // 为空时回显预检请求的access-control-request-headers
+    std::vector<std::string> expose_headers;
+    bool credentials = false; // 不能与"*"同时使用，否则启动时报错退出
+    int max_age = -1; // 小于0时不返回access-control-max-age
+  };
+  /**
+   * 初始化时编译好的CORS配置，请求处理时只做查找。
+   * 完整origin放入哈希表；通配子域名按scheme与端口分组，域名按label倒序插入字典树，
+   * *.example.com匹配a.example.com与a.b.example.com，不匹配example.com本身。
+   **/
+  class CorsPolicy {
+    private:
+      struct Node {
+        std::map<std::string, std::unique_ptr<Node>, std::less<>> children;
+        bool wildcard = false; // 其下任意更深的子域名都允许
+      };
+      bool any_origin = false;
+      std::unordered_set<std::string> exact;
+      std::unordered_map<std::string, Node> wildcard_roots; // key为"scheme:port"
+      bool has_credentials;
+      std::string star = "*";
+      std::string methods_value;
+      std::string headers_value;
+      std::string expose_value;
+      std::string max_age_value;
+      uint64_t id;
+      std::shared_ptr<const void> alive; // 线程局部缓存持有其weak_ptr，policy销毁后据此清理
+      // 序列化好的预检响应，Date头以外的部分不变，每秒只重新拼接一次
+      struct PreflightEntry {
+        std::string key;
+        std::string head; // 不含Date头与结尾空行
+        Slice response;
+        time_t second = -1;
+      };
+      // 每个IO线程一份，无需加锁
+      struct PreflightCache {
+        std::list<PreflightEntry> entries; // 最近使用的在前
+        std::unordered_map<std::string_view, std::list<PreflightEntry>::iterator> index;
+      };
+      struct LocalCache {
+        uint64_t id;
+        std::weak_ptr<const void> alive;
+        std::unique_ptr<PreflightCache> cache;
+      };
+
+      bool match_wildcard(std::string_view origin) const;
+      PreflightCache& local_cache() const;
+    public:
+      explicit CorsPolicy(const CorsOptions& options);
+      /**
+       * 返回access-control-allow-origin的值，不允许时返回nullptr。
+       * 允许任意origin时为"*"，否则回显origin本身（此时响应需要Vary: Origin）
+       **/
+      const std::string* allow_origin(const std::string& origin) const;
+      bool credentials() const { return has_credentials; }
+      // 以下为预先拼接好的响应头，为空时不返回
+      const std::string& allow_methods() const { return methods_value; }
+      const std::string& allow_headers() const { return headers_value; }
+      const std::string& expose_headers() const { return expose_value; }
+      const std::string& max_age() const { return max_age_value; }
+      /**
+       * 预检请求（带origin与access-control-request-method的OPTIONS）的响应头，
+       * origin不允许或不是预检请求时返回false
+       **/
+      bool preflight_headers(const HTTPRequest& req, std::vector<std::pair<std::string, std::string>>& headers) const;
+      /**
+       * 供IO线程prefilter使用：按(origin, method, 请求头)缓存完整的204响应，LRU淘汰。
+       * 不是可缓存的HTTP/1.1预检请求时返回空Slice，交给filter链处理
+       **/
+      Slice preflight(const HTTPRequest& req) const;
+  };
+}
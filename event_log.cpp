@@ -0,0 +1,132 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "event_log.h"
+#include "clock.h"
+
+namespace {
+  const char* level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+  const char* event_names[] = {"accept", "close", "timeout", "error"};
+}
+
+pulsation::EventLog::EventLog(EventLevel level, const std::string& path): level(level), fd(STDERR_FILENO), own_fd(false) {
+  static std::atomic<uint64_t> next_id{1};
+  id = next_id++;
+  if (!path.empty()) {
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      perror("Error open event log");
+      fd = STDERR_FILENO;
+    } else {
+      own_fd = true;
+    }
+  }
+  writer = std::thread([this] { run(); });
+}
+
+pulsation::EventLog::~EventLog() {
+  stopping.store(true);
+  wait_cv.notify_all();
+  if (writer.joinable()) {
+    writer.join();
+  }
+  if (own_fd) {
+    close(fd);
+  }
+}
+
+pulsation::SpscRing<pulsation::EventRecord, EVENT_LOG_RING_SIZE>* pulsation::EventLog::local_ring() {
+  thread_local std::vector<std::pair<uint64_t, SpscRing<EventRecord, EVENT_LOG_RING_SIZE>*>> local;
+  for (auto& item : local) {
+    if (item.first == id) {
+      return item.second;
+    }
+  }
+  // 每个线程只在第一次写事件时注册一次
+  std::lock_guard<std::mutex> lock(mutex);
+  rings.emplace_back(new SpscRing<EventRecord, EVENT_LOG_RING_SIZE>());
+  local.emplace_back(id, rings.back().get());
+  return rings.back().get();
+}
+
+void pulsation::EventLog::emit(EventLevel l, ConnEvent type, int fd, uint32_t addr, uint16_t port, int error) {
+  if (!enabled(l)) {
+    return;
+  }
+  EventRecord record{Clock::now_ms(), addr, port, static_cast<uint8_t>(l), static_cast<uint8_t>(type), fd, error};
+  if (!local_ring()->push(record)) {
+    dropped_count++;
+  }
+}
+
+void pulsation::EventLog::run() {
+  std::string buffer;
+  while (1) {
+    bool stop = stopping.load();
+    size_t count = drain(buffer);
+    if (!buffer.empty()) {
+      size_t offset = 0;
+      while (offset < buffer.size()) {
+        ssize_t n = write(fd, buffer.data() + offset, buffer.size() - offset);
+        if (n < 0) {
+          if (errno == EINTR) continue;
+          break;
+        }
+        offset += n;
+      }
+      buffer.clear();
+    }
+    if (stop) {
+      return;
+    }
+    if (count == 0) {
+      std::unique_lock<std::mutex> lock(wait_mutex);
+      wait_cv.wait_for(lock, std::chrono::milliseconds(100));
+    }
+  }
+}
+
+size_t pulsation::EventLog::drain(std::string& buffer) {
+  std::vector<SpscRing<EventRecord, EVENT_LOG_RING_SIZE>*> snapshot;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& ring : rings) {
+      snapshot.push_back(ring.get());
+    }
+  }
+  EventRecord batch[64];
+  size_t total = 0;
+  for (size_t index = 0; index < snapshot.size(); ++index) {
+    size_t n;
+    while ((n = snapshot[index]->pop(batch, 64)) > 0) {
+      total += n;
+      for (size_t i = 0; i < n; ++i) {
+        EventRecord& r = batch[i];
+        time_t seconds = r.time_ms / 1000;
+        struct tm tstruct;
+        localtime_r(&seconds, &tstruct);
+        char time_buf[32];
+        strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %X", &tstruct);
+        char addr[INET_ADDRSTRLEN];
+        struct in_addr in;
+        in.s_addr = r.addr;
+        inet_ntop(AF_INET, &in, addr, sizeof(addr));
+        char line[256];
+        int size = snprintf(line, sizeof(line), "%s.%03d level=%s event=%s fd=%d peer=%s:%u thread=%zu",
+          time_buf, static_cast<int>(r.time_ms % 1000), level_names[r.level], event_names[r.type], r.fd, addr, r.port, index);
+        buffer.append(line, size);
+        if (r.error != 0) {
+          buffer += " error=\"";
+          buffer += strerror(r.error);
+          buffer += "\"";
+        }
+        buffer += '\n';
+      }
+    }
+  }
+  return total;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+#include "spsc_ring.h"
+
+namespace pulsation {
+  #define EVENT_LOG_RING_SIZE 8192
+  enum class EventLevel : uint8_t { DEBUG = 0, INFO, WARN, ERROR, OFF };
+  // 连接生命周期事件
+  enum class ConnEvent : uint8_t { ACCEPT = 0, CLOSE, TIMEOUT, ERROR };
+  struct EventRecord {
+    int64_t time_ms;
+    uint32_t addr;  // 网络字节序的IPv4地址
+    uint16_t port;
+    uint8_t level;
+    uint8_t type;
+    int32_t fd;
+    int32_t error;  // errno，没有时为0
+  };
+  /**
+   * 结构化的异步事件日志，默认关闭（Server未配置时不创建）。
+   * 每个IO线程写自己的环形队列，不加锁也不格式化，满时丢弃并计数；
+   * 后台线程以key=value的形式写入文件，path为空时写到stderr。
+   **/
+  class EventLog {
+    private:
+      EventLevel level;
+      int fd;
+      bool own_fd;
+      uint64_t id;
+      std::mutex mutex; // 保护rings的注册
+      std::vector<std::unique_ptr<SpscRing<EventRecord, EVENT_LOG_RING_SIZE>>> rings;
+      std::atomic<uint64_t> dropped_count{0};
+      std::atomic<bool> stopping{false};
+      std::mutex wait_mutex;
+      std::condition_variable wait_cv;
+      std::thread writer;
+
+      SpscRing<EventRecord, EVENT_LOG_RING_SIZE>* local_ring();
+      void run();
+      size_t drain(std::string& buffer);
+    public:
+      EventLog(EventLevel level, const std::string& path = "");
+      ~EventLog();
+      EventLog(const EventLog&) = delete;
+      EventLog& operator=(const EventLog&) = delete;
+      bool enabled(EventLevel l) const { return l >= level; }
+      void emit(EventLevel l, ConnEvent type, int fd, uint32_t addr, uint16_t port, int error = 0);
+      uint64_t dropped() const { return dropped_count.load(); }
+  };
+}
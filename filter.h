@@ -10,6 +10,13 @@ namespace pulsation {
   typedef std::function<void(FilterProperties&, Context&, std::function<void()>)> CallbackFunc;
   typedef std::function<void(FilterProperties&)> InitFunc;
   typedef std::function<void()> NextFunc;
+  /**
+   * 在IO线程中、请求头解析完成且body到达前执行的轻量检查（鉴权、路由、大小等），不能阻塞。
+   * 抛出ServerException拒绝请求，响应后关闭连接，body不会被读取；
+   * 返回非空Slice时作为完整响应直接写出，请求不再进入worker队列；
+   * 返回空Slice表示放行，带有Expect: 100-continue的请求此时回复100 Continue。
+   **/
+  typedef std::function<Slice(HTTPRequest&)> PreFilterFunc;
   class Filter {
     private:
       FilterProperties properties;
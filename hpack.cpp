@@ -0,0 +1,314 @@
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include "hpack.h"
+
+using namespace std;
+
+namespace {
+  // RFC 7541 附录A 静态表
+  const pair<const char*, const char*> static_table[] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"},
+    {":path", "/"}, {":path", "/index.html"}, {":scheme", "http"},
+    {":scheme", "https"}, {":status", "200"}, {":status", "204"},
+    {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"}, {"accept-language", ""}, {"accept-ranges", ""},
+    {"accept", ""}, {"access-control-allow-origin", ""}, {"age", ""},
+    {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""},
+    {"content-length", ""}, {"content-location", ""}, {"content-range", ""},
+    {"content-type", ""}, {"cookie", ""}, {"date", ""},
+    {"etag", ""}, {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""}, {"if-match", ""},
+    {"if-modified-since", ""}, {"if-none-match", ""}, {"if-range", ""},
+    {"if-unmodified-since", ""}, {"last-modified", ""}, {"link", ""},
+    {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""},
+    {"refresh", ""}, {"retry-after", ""}, {"server", ""},
+    {"set-cookie", ""}, {"strict-transport-security", ""}, {"transfer-encoding", ""},
+    {"user-agent", ""}, {"vary", ""}, {"via", ""},
+    {"www-authenticate", ""}
+  };
+  // RFC 7541 附录B Huffman编码表，最后一项为EOS
+  const uint32_t huffman_codes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff
+  };
+  const uint8_t huffman_lengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30
+  };
+  const size_t STATIC_TABLE_SIZE = sizeof(static_table) / sizeof(static_table[0]);
+
+  // Huffman解码树，children为0表示不存在，symbol >= 0表示叶子
+  struct HuffmanNode {
+    int children[2] = {0, 0};
+    int symbol = -1;
+  };
+
+  const vector<HuffmanNode>& huffman_tree() {
+    static const vector<HuffmanNode> tree = []{
+      vector<HuffmanNode> nodes(1);
+      for (int symbol = 0; symbol < 257; ++symbol) {
+        int node = 0;
+        for (int bit = huffman_lengths[symbol] - 1; bit >= 0; --bit) {
+          int b = (huffman_codes[symbol] >> bit) & 1;
+          if (nodes[node].children[b] == 0) {
+            nodes[node].children[b] = nodes.size();
+            nodes.emplace_back();
+          }
+          node = nodes[node].children[b];
+        }
+        nodes[node].symbol = symbol;
+      }
+      return nodes;
+    }();
+    return tree;
+  }
+
+  bool huffman_decode(const uint8_t* data, size_t size, string& out) {
+    const vector<HuffmanNode>& tree = huffman_tree();
+    int node = 0;
+    int depth = 0;  // 当前未完成符号已消费的位数
+    bool all_ones = true;
+    for (size_t i = 0; i < size; ++i) {
+      for (int bit = 7; bit >= 0; --bit) {
+        int b = (data[i] >> bit) & 1;
+        node = tree[node].children[b];
+        if (node == 0) {
+          return false;
+        }
+        depth++;
+        all_ones = all_ones && b == 1;
+        if (tree[node].symbol >= 0) {
+          if (tree[node].symbol == 256) {
+            // 字符串中不能出现EOS
+            return false;
+          }
+          out.push_back(static_cast<char>(tree[node].symbol));
+          node = 0;
+          depth = 0;
+          all_ones = true;
+        }
+      }
+    }
+    // 填充位必须是不超过7位的EOS前缀（全1）
+    return depth <= 7 && all_ones;
+  }
+
+  bool decode_integer(const uint8_t*& p, const uint8_t* end, int prefix, uint64_t& value) {
+    if (p >= end) return false;
+    uint64_t max_prefix = (1 << prefix) - 1;
+    value = *p++ & max_prefix;
+    if (value < max_prefix) return true;
+    int shift = 0;
+    while (p < end) {
+      uint8_t b = *p++;
+      value += static_cast<uint64_t>(b & 0x7f) << shift;
+      shift += 7;
+      if (!(b & 0x80)) return true;
+      if (shift > 28) return false;
+    }
+    return false;
+  }
+
+  bool decode_string(const uint8_t*& p, const uint8_t* end, string& out) {
+    if (p >= end) return false;
+    bool huffman = *p & 0x80;
+    uint64_t length;
+    if (!decode_integer(p, end, 7, length) || length > static_cast<uint64_t>(end - p)) {
+      return false;
+    }
+    out.clear();
+    if (huffman) {
+      if (!huffman_decode(p, length, out)) return false;
+    } else {
+      out.assign(reinterpret_cast<const char*>(p), length);
+    }
+    p += length;
+    return true;
+  }
+
+  void encode_integer(uint64_t value, int prefix, uint8_t flags, string& out) {
+    uint64_t max_prefix = (1 << prefix) - 1;
+    if (value < max_prefix) {
+      out.push_back(static_cast<char>(flags | value));
+      return;
+    }
+    out.push_back(static_cast<char>(flags | max_prefix));
+    value -= max_prefix;
+    while (value >= 128) {
+      out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+      value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+  }
+
+  void encode_string(const string& value, string& out) {
+    encode_integer(value.size(), 7, 0, out);
+    out += value;
+  }
+}
+
+void pulsation::HpackDecoder::evict(size_t max_size) {
+  while (table_size > max_size && !dynamic_table.empty()) {
+    auto& field = dynamic_table.back();
+    table_size -= field.first.size() + field.second.size() + 32;
+    dynamic_table.pop_back();
+  }
+}
+
+void pulsation::HpackDecoder::insert(const string& name, const string& value) {
+  size_t size = name.size() + value.size() + 32;
+  if (size > max_table_size) {
+    // 比整个表还大的条目会清空动态表
+    evict(0);
+    return;
+  }
+  evict(max_table_size - size);
+  dynamic_table.emplace_front(name, value);
+  table_size += size;
+}
+
+bool pulsation::HpackDecoder::lookup(uint64_t index, pair<string, string>& field) const {
+  if (index == 0) {
+    return false;
+  }
+  if (index <= STATIC_TABLE_SIZE) {
+    field = make_pair(string(static_table[index - 1].first), string(static_table[index - 1].second));
+    return true;
+  }
+  index -= STATIC_TABLE_SIZE + 1;
+  if (index >= dynamic_table.size()) {
+    return false;
+  }
+  field = dynamic_table[index];
+  return true;
+}
+
+bool pulsation::HpackDecoder::decode(const uint8_t* data, size_t size, HeaderList& headers, size_t max_list_size, bool& oversized) {
+  const uint8_t* p = data;
+  const uint8_t* end = data + size;
+  size_t list_size = 0;
+  oversized = false;
+  // 引用大条目的短表示可以解码出远大于block的列表，超出上限后不再保存字段
+  auto append = [&](pair<string, string>&& field) {
+    list_size += field.first.size() + field.second.size() + 32;
+    if (list_size > max_list_size) {
+      oversized = true;
+      headers.clear();
+    }
+    if (!oversized) {
+      headers.push_back(std::move(field));
+    }
+  };
+  while (p < end) {
+    uint8_t b = *p;
+    uint64_t index;
+    pair<string, string> field;
+    if (b & 0x80) {
+      // 索引头
+      if (!decode_integer(p, end, 7, index)) return false;
+      if (oversized) {
+        if (index == 0 || index > STATIC_TABLE_SIZE + dynamic_table.size()) return false;
+        continue;
+      }
+      if (!lookup(index, field)) return false;
+      append(std::move(field));
+    } else if ((b & 0xe0) == 0x20) {
+      // 动态表大小更新，不能超过SETTINGS_HEADER_TABLE_SIZE
+      if (!decode_integer(p, end, 5, index) || index > HPACK_TABLE_SIZE) return false;
+      max_table_size = index;
+      evict(max_table_size);
+    } else {
+      // 字面量：01 加入索引，0000 不加入索引，0001 永不索引
+      bool indexing = (b & 0xc0) == 0x40;
+      if (!decode_integer(p, end, indexing ? 6 : 4, index)) return false;
+      if (index > 0) {
+        if (!lookup(index, field)) return false;
+      } else if (!decode_string(p, end, field.first)) {
+        return false;
+      }
+      if (!decode_string(p, end, field.second)) return false;
+      if (indexing) {
+        insert(field.first, field.second);
+      }
+      append(std::move(field));
+    }
+  }
+  return true;
+}
+
+void pulsation::hpack_encode(const string& name, const string& value, string& out) {
+  // 名称到静态表中第一个同名条目的下标
+  static const unordered_map<string, size_t> name_map = []{
+    unordered_map<string, size_t> map;
+    for (size_t i = 0; i < STATIC_TABLE_SIZE; ++i) {
+      map.insert(make_pair(string(static_table[i].first), i));
+    }
+    return map;
+  }();
+  size_t name_index = 0;
+  auto it = name_map.find(name);
+  if (it != name_map.end()) {
+    name_index = it->second + 1;
+    for (size_t i = it->second; i < STATIC_TABLE_SIZE && name == static_table[i].first; ++i) {
+      if (value == static_table[i].second) {
+        encode_integer(i + 1, 7, 0x80, out);
+        return;
+      }
+    }
+  }
+  encode_integer(name_index, 4, 0, out);
+  if (name_index == 0) {
+    encode_string(name, out);
+  }
+  encode_string(value, out);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <cstdint>
+
+namespace pulsation {
+  #define HPACK_TABLE_SIZE 4096
+  #define HPACK_MAX_LIST_SIZE (64 * 1024) // 解码后header列表的上限，按RFC 7540的方法计算（每个字段另加32字节）
+  typedef std::vector<std::pair<std::string, std::string>> HeaderList;
+  // HPACK解码器，每个HTTP/2连接一个，维护对端编码器对应的动态表
+  class HpackDecoder {
+    private:
+      std::deque<std::pair<std::string, std::string>> dynamic_table;
+      size_t table_size = 0;
+      size_t max_table_size = HPACK_TABLE_SIZE;
+      void insert(const std::string& name, const std::string& value);
+      void evict(size_t max_size);
+      bool lookup(uint64_t index, std::pair<std::string, std::string>& field) const;
+    public:
+      /**
+       * 解码一个完整的header block，出错时返回false（连接级COMPRESSION_ERROR）。
+       * 解码后的列表超过max_list_size时oversized置为true、headers为空，仍解码到结尾以保持动态表与对端一致
+       **/
+      bool decode(const uint8_t* data, size_t size, HeaderList& headers, size_t max_list_size, bool& oversized);
+  };
+  /**
+   * 无状态编码：完全匹配静态表时使用索引，否则使用不加入索引的字面量。
+   * 不依赖连接上的动态表，因此可以直接在worker线程中编码响应头。
+   **/
+  void hpack_encode(const std::string& name, const std::string& value, std::string& out);
+}
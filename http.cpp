@@ -0,0 +1,420 @@
+#include <sstream>
+#include <strings.h>
+#include "http.h"
+#include "hpack.h"
+#include "clock.h"
+
+namespace {
+  enum {
+    PARSED_PATH = 1,
+    PARSED_QUERY = 2,
+    PARSED_COOKIE = 4
+  };
+
+  int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  // 不含转义字符时直接引用原始数据，否则解码后追加到decoded中
+  pulsation::HTTPRequest::Span make_span(const string& src, uint8_t source, size_t offset, size_t size,
+                                         bool form, string& decoded) {
+    string_view raw(src.data() + offset, size);
+    if (raw.find('%') == string_view::npos && (!form || raw.find('+') == string_view::npos)) {
+      return {source, static_cast<uint32_t>(offset), static_cast<uint32_t>(size)};
+    }
+    size_t start = decoded.size();
+    for (size_t i = 0; i < raw.size(); ++i) {
+      if (raw[i] == '%' && i + 2 < raw.size() && hex_value(raw[i + 1]) >= 0 && hex_value(raw[i + 2]) >= 0) {
+        decoded.push_back(static_cast<char>(hex_value(raw[i + 1]) * 16 + hex_value(raw[i + 2])));
+        i += 2;
+      } else if (form && raw[i] == '+') {
+        decoded.push_back(' ');
+      } else {
+        decoded.push_back(raw[i]);
+      }
+    }
+    return {1, static_cast<uint32_t>(start), static_cast<uint32_t>(decoded.size() - start)};
+  }
+
+  string_view resolve(const pulsation::HTTPRequest& req, const pulsation::HTTPRequest::Span& span) {
+    const string* src = &req.target;
+    if (span.source == 1) {
+      src = &req.decoded;
+    } else if (span.source == 2) {
+      src = &req.headers.at("cookie");
+    }
+    return string_view(src->data() + span.offset, span.size);
+  }
+
+  // query string的范围：?之后、#之前
+  pair<size_t, size_t> query_range(const string& target) {
+    size_t end = target.find('#');
+    if (end == string::npos) end = target.size();
+    size_t start = target.find('?');
+    if (start == string::npos || start > end) return make_pair(end, end);
+    return make_pair(start + 1, end);
+  }
+
+  string_view find_pair(const pulsation::HTTPRequest& req,
+                        const vector<pair<pulsation::HTTPRequest::Span, pulsation::HTTPRequest::Span>>& spans,
+                        string_view key) {
+    for (auto& item : spans) {
+      if (resolve(req, item.first) == key) {
+        return resolve(req, item.second);
+      }
+    }
+    return string_view();
+  }
+
+  // 1xx、204与304不能带content-length（304的content-length表示的是200响应的长度）
+  bool bodiless_status(const string& status) {
+    return status[0] == '1' || status == "204" || status == "304";
+  }
+
+  bool close_requested(pulsation::HTTPRequest& request) {
+    auto it = request.headers.find("connection");
+    return it != request.headers.end() && strcasecmp(it->second.c_str(), "close") == 0;
+  }
+
+  void run_head_hooks(pulsation::HTTPResponse& response) {
+    for (auto& hook : response.on_head) {
+      hook(response);
+    }
+  }
+
+  void run_end_hooks(pulsation::HTTPResponse& response) {
+    // 只调用一次，如end之后又close
+    auto hooks = std::move(response.on_end);
+    response.on_end.clear();
+    for (auto& hook : hooks) {
+      hook(response);
+    }
+  }
+}
+
+string_view pulsation::HTTPRequest::path() const {
+  if (!(parsed & PARSED_PATH)) {
+    size_t end = target.find_first_of("?#");
+    if (end == string::npos) end = target.size();
+    path_span = make_span(target, 0, 0, end, false, decoded);
+    parsed |= PARSED_PATH;
+  }
+  return resolve(*this, path_span);
+}
+
+string_view pulsation::HTTPRequest::query(string_view key) const {
+  if (!(parsed & PARSED_QUERY)) {
+    auto range = query_range(target);
+    size_t pos = range.first;
+    while (pos < range.second) {
+      size_t end = target.find('&', pos);
+      if (end == string::npos || end > range.second) end = range.second;
+      if (end > pos) {
+        size_t eq = target.find('=', pos);
+        if (eq == string::npos || eq > end) eq = end;
+        Span k = make_span(target, 0, pos, eq - pos, true, decoded);
+        Span v = eq < end ? make_span(target, 0, eq + 1, end - eq - 1, true, decoded) : Span{0, static_cast<uint32_t>(end), 0};
+        query_spans.emplace_back(k, v);
+      }
+      pos = end + 1;
+    }
+    parsed |= PARSED_QUERY;
+  }
+  return find_pair(*this, query_spans, key);
+}
+
+string_view pulsation::HTTPRequest::cookie(string_view key) const {
+  if (!(parsed & PARSED_COOKIE)) {
+    auto it = headers.find("cookie");
+    if (it != headers.end()) {
+      const string& header = it->second;
+      size_t pos = 0;
+      while (pos < header.size()) {
+        size_t end = header.find(';', pos);
+        if (end == string::npos) end = header.size();
+        size_t eq = header.find('=', pos);
+        if (eq != string::npos && eq < end) {
+          size_t k_start = header.find_first_not_of(' ', pos);
+          size_t k_end = header.find_last_not_of(' ', eq - 1);
+          size_t v_start = header.find_first_not_of(' ', eq + 1);
+          size_t v_end = end;
+          while (v_end > v_start && header[v_end - 1] == ' ') v_end--;
+          if (v_start > v_end) v_start = v_end;
+          // 去掉值两端的引号
+          if (v_end - v_start >= 2 && header[v_start] == '"' && header[v_end - 1] == '"') {
+            v_start++;
+            v_end--;
+          }
+          if (k_start < eq && k_end != string::npos && k_end >= k_start) {
+            cookie_spans.emplace_back(Span{2, static_cast<uint32_t>(k_start), static_cast<uint32_t>(k_end + 1 - k_start)},
+                                      Span{2, static_cast<uint32_t>(v_start), static_cast<uint32_t>(v_end - v_start)});
+          }
+        }
+        pos = end + 1;
+      }
+    }
+    parsed |= PARSED_COOKIE;
+  }
+  return find_pair(*this, cookie_spans, key);
+}
+
+
+pulsation::Slice pulsation::HTTPResponse::take_body() {
+  Slice result{nullptr, nullptr, 0};
+  if (body.empty()) {
+    std::swap(result, shared_body);
+  } else {
+    result = make_slice(std::move(body));
+    body.clear();
+  }
+  shared_body = Slice{nullptr, nullptr, 0};
+  return result;
+}
+
+string pulsation::serialize_head(HTTPResponse& response, BodyFraming framing) {
+  std::ostringstream s_header;
+  s_header << "HTTP/1.1 " << response.status_code << " " << status_codes.at(response.status_code) << "\r\n";
+  unordered_map<string, string>::iterator h_iter = response.headers.begin();
+  while (h_iter != response.headers.end()) {
+    s_header << h_iter->first << ": " << h_iter->second << "\r\n";
+    h_iter++;
+  }
+  if (response.headers.find("date") == response.headers.end()) {
+    s_header << "date: " << Clock::http_date() << "\r\n";
+  }
+  if (framing == BodyFraming::CHUNKED) {
+    s_header << "transfer-encoding: chunked\r\n";
+  } else if (framing == BodyFraming::LENGTH && !bodiless_status(response.status_code)) {
+    s_header << "content-length: " << response.body_view().size() << "\r\n";
+  }
+  s_header << "\r\n";
+  return s_header.str();
+}
+
+string pulsation::serialize_h2_head(HTTPResponse& response, bool streaming) {
+  string block;
+  hpack_encode(":status", response.status_code, block);
+  for (auto& header : response.headers) {
+    // 连接相关的头在HTTP/2中无意义
+    if (header.first == "connection" || header.first == "transfer-encoding" || header.first == "keep-alive") {
+      continue;
+    }
+    hpack_encode(header.first, header.second, block);
+  }
+  if (response.headers.find("date") == response.headers.end()) {
+    hpack_encode("date", string(Clock::http_date()), block);
+  }
+  if (!streaming && !bodiless_status(response.status_code)) {
+    hpack_encode("content-length", std::to_string(response.body_view().size()), block);
+  }
+  return block;
+}
+
+bool pulsation::Context::write(const string& chunk) {
+  Connection& conn = *request.conn;
+  if (response.finished || !conn.wait_writable()) {
+    return false;
+  }
+  if (request.stream_id != 0) {
+    // HTTP/2由帧本身分隔数据，不需要chunked编码
+    if (!response.head_sent) {
+      if (response.status_code.empty()) {
+        response.status_code = "200";
+      }
+      response.headers.erase("content-length");
+      run_head_hooks(response);
+      conn.send(request.seq, make_slice(serialize_h2_head(response, true)), false, false, MSG_H2_HEADERS);
+      response.head_sent = true;
+    }
+    if (response.encode) {
+      string encoded = response.encode(chunk, false);
+      if (!encoded.empty()) {
+        response.bytes_sent += encoded.size();
+        conn.send(request.seq, make_slice(std::move(encoded)), false, false, MSG_H2_DATA);
+      }
+    } else if (!chunk.empty()) {
+      response.bytes_sent += chunk.size();
+      conn.send(request.seq, make_slice(chunk), false, false, MSG_H2_DATA);
+    }
+    return true;
+  }
+  // HTTP/1.0不支持chunked，body不带分隔直接发送，以关闭连接结束
+  bool raw = request.protocal != "HTTP/1.1";
+  std::ostringstream s_chunk;
+  if (!response.head_sent) {
+    if (response.status_code.empty()) {
+      response.status_code = "200";
+    }
+    response.headers.erase("content-length");
+    if (raw || close_requested(request)) {
+      response.close = true;
+    }
+    if (response.close) {
+      response.headers["connection"] = "close";
+    }
+    run_head_hooks(response);
+    s_chunk << serialize_head(response, raw ? BodyFraming::CLOSE : BodyFraming::CHUNKED);
+    response.head_sent = true;
+  }
+  // 压缩器攒够数据前可能没有输出
+  string encoded;
+  const string* data = &chunk;
+  if (response.encode) {
+    encoded = response.encode(chunk, false);
+    data = &encoded;
+  }
+  // 空chunk会被当作结束标记，跳过
+  if (!data->empty()) {
+    response.bytes_sent += data->size();
+    if (raw) {
+      s_chunk << *data;
+    } else {
+      s_chunk << std::hex << data->size() << "\r\n" << *data << "\r\n";
+    }
+  }
+  if (s_chunk.tellp() > 0) {
+    conn.send(request.seq, make_slice(s_chunk.str()), false);
+  }
+  return true;
+}
+
+void pulsation::Context::end() {
+  if (response.finished) {
+    return;
+  }
+  response.finished = true;
+  if (request.stream_id != 0) {
+    end_h2();
+    run_end_hooks(response);
+    return;
+  }
+  if (response.head_sent) {
+    bool raw = request.protocal != "HTTP/1.1";
+    std::ostringstream s_chunk;
+    if (response.encode) {
+      string tail = response.encode(string_view(), true);
+      if (!tail.empty()) {
+        response.bytes_sent += tail.size();
+        if (raw) {
+          s_chunk << tail;
+        } else {
+          s_chunk << std::hex << tail.size() << "\r\n" << tail << "\r\n";
+        }
+      }
+    }
+    if (!raw) {
+      s_chunk << "0\r\n\r\n";
+    }
+    request.conn->send(request.seq, make_slice(s_chunk.str()), true, response.close);
+    run_end_hooks(response);
+    return;
+  }
+  if (close_requested(request)) {
+    response.close = true;
+  }
+  // 未被接受的WebSocket升级请求，IO线程已停止解析该连接
+  if (request.headers.find("upgrade") != request.headers.end() && strcasecmp(request.headers["upgrade"].c_str(), "websocket") == 0) {
+    response.close = true;
+  }
+  if (response.close) {
+    response.headers["connection"] = "close";
+  }
+  run_head_hooks(response);
+  response.head_sent = true;
+  response.bytes_sent = response.body_view().size();
+  if (response.body_view().empty()) {
+    request.conn->send(request.seq, make_slice(serialize_head(response, BodyFraming::LENGTH)), true, response.close);
+  } else {
+    request.conn->send(request.seq, make_slice(serialize_head(response, BodyFraming::LENGTH)), false);
+    // body直接移交给IO线程，不再拷贝
+    request.conn->send(request.seq, response.take_body(), true, response.close);
+  }
+  run_end_hooks(response);
+}
+
+void pulsation::Context::end_h2() {
+  Connection& conn = *request.conn;
+  if (response.head_sent) {
+    if (response.encode) {
+      Slice tail = make_slice(response.encode(string_view(), true));
+      response.bytes_sent += tail.size;
+      conn.send(request.seq, std::move(tail), true, false, MSG_H2_DATA);
+      return;
+    }
+    conn.send(request.seq, Slice{nullptr, nullptr, 0}, true, false, MSG_H2_DATA);
+    return;
+  }
+  run_head_hooks(response);
+  response.head_sent = true;
+  bool empty = response.body_view().empty();
+  response.bytes_sent = response.body_view().size();
+  conn.send(request.seq, make_slice(serialize_h2_head(response, false)), empty, false, MSG_H2_HEADERS);
+  if (!empty) {
+    conn.send(request.seq, response.take_body(), true, false, MSG_H2_DATA);
+  }
+}
+
+void pulsation::Context::close() {
+  response.finished = true;
+  if (request.stream_id != 0) {
+    // HTTP/2只中止当前流
+    request.conn->send(request.seq, Slice{nullptr, nullptr, 0}, true, false, MSG_H2_RESET);
+  } else {
+    request.conn->send(request.seq, Slice{nullptr, nullptr, 0}, true, true);
+  }
+  run_end_hooks(response);
+}
+
+void pulsation::Context::websocket(WebSocketHandler handler) {
+  if (request.stream_id != 0) {
+    throw ServerException{"501", "WebSocket over HTTP/2 is not supported"};
+  }
+  auto upgrade = request.headers.find("upgrade");
+  auto key = request.headers.find("sec-websocket-key");
+  if (request.method != "GET" || upgrade == request.headers.end() || strcasecmp(upgrade->second.c_str(), "websocket") != 0 ||
+      key == request.headers.end()) {
+    throw ServerException{"400", "Bad WebSocket handshake"};
+  }
+  auto version = request.headers.find("sec-websocket-version");
+  if (version == request.headers.end() || version->second != "13") {
+    response.headers["sec-websocket-version"] = "13";
+    throw ServerException{"426", "Unsupported WebSocket version"};
+  }
+  response.finished = true;
+  response.head_sent = true;
+  response.status_code = "101";
+  request.conn->websocket = std::make_shared<WebSocket>(request.conn, std::move(handler));
+  request.conn->send(request.seq, make_slice("HTTP/1.1 101 Switching Protocols\r\nupgrade: websocket\r\nconnection: Upgrade\r\n"
+    "sec-websocket-accept: " + ws_accept_key(key->second) + "\r\n\r\n"), true, false, MSG_WS_ACCEPT);
+  run_end_hooks(response);
+}
+
+void pulsation::Context::event_stream(const std::shared_ptr<EventTopic>& topic) {
+  if (response.head_sent) {
+    throw ServerException{"500", "Response already started"};
+  }
+  response.status_code = "200";
+  response.headers["content-type"] = "text/event-stream";
+  response.headers["cache-control"] = "no-cache";
+  response.headers.erase("content-length");
+  // 事件直接挂到连接上发送，不经过write，钩子据finished判断不能设置encode
+  response.finished = true;
+  run_head_hooks(response);
+  response.head_sent = true;
+  Connection& conn = *request.conn;
+  if (request.stream_id != 0) {
+    conn.send(request.seq, make_slice(serialize_h2_head(response, true)), false, false, MSG_H2_HEADERS);
+  } else {
+    conn.send(request.seq, make_slice(serialize_head(response, BodyFraming::CHUNKED)), false);
+  }
+  {
+    std::lock_guard<std::mutex> lock(conn.mutex);
+    conn.subscriptions.emplace_back(request.seq, topic);
+  }
+  // 不同线程发出的消息没有先后保证，订阅由IO线程在响应头之后生效，事件不会先于响应头写出
+  conn.send(request.seq, Slice{nullptr, nullptr, 0}, false, false, MSG_SSE_OPEN);
+  run_end_hooks(response);
+}
@@ -1,8 +1,14 @@
 #pragma once
 #include <cstring>
+#include <cstdint>
 #include <regex>
 #include <any>
 #include <unordered_map>
+#include <functional>
+#include <string_view>
+#include "connection.h"
+#include "websocket.h"
+#include "sse.h"
 using namespace std;
 
 namespace pulsation {
@@ -18,8 +24,9 @@ namespace pulsation {
     {"408", "Request Time-out"}, {"409", "Conflict"}, {"410", "Gone"},
     {"411", "Length Required"}, {"412", "Precondition Failed"}, {"413", "Request Entity Too Large"},
     {"414", "Request-URI Too Large"}, {"415", "Unsupported Media Type"}, {"416", "Requested range not satisfiable"},
-    {"502", "Bad Gateway"}, {"503", "Service Unavailable"}, {"504", "Gateway Time-out"},
-    {"505", "HTTP Version not supported"}
+    {"417", "Expectation Failed"}, {"426", "Upgrade Required"}, {"431", "Request Header Fields Too Large"},
+    {"500", "Internal Server Error"}, {"501", "Not Implemented"}, {"502", "Bad Gateway"},
+    {"503", "Service Unavailable"}, {"504", "Gateway Time-out"}, {"505", "HTTP Version not supported"}
   };
   const unordered_map<string, string> ext_type = {
     {".au", "audio/base"}, {".bmp", "application/x-bmp"}, {".html", "text/html"},
@@ -28,32 +35,126 @@ namespace pulsation {
     {".mp4", "video/mpeg4"}, {".css", "text/css"}, {".dtd", "text/xml"},
     {".htm", "text/html"}, {".js", "application/x-javascript"}, {".png", "image/png"},
   };
-  struct TCPBuffer {
-      int epoll_fd;
-      int fd;
-      int len;
-      string content;
-  };
+  class BodyFile;
   struct HTTPRequest {
     int epoll_fd;
     int fd;
     string method;
-    string path;
+    string target; // 原始请求目标，包含未解码的query string
     string protocal;
     unordered_map<string, string> headers;
     string body;
+    // 超过落盘阈值的body写入文件，此时body为空，可通过BodyStream统一读取
+    shared_ptr<BodyFile> body_file;
+    shared_ptr<Connection> conn;
+    uint64_t seq = 0; // 连接上的请求序号，流水线请求的响应按此顺序写出
+    uint32_t stream_id = 0; // HTTP/2的流，0表示HTTP/1.x
+    /**
+     * 以下访问器在首次调用时才解析并缓存结果，返回的view指向请求内部的数据，
+     * 请求存活且未被修改期间有效。不存在的key返回data()为nullptr的空view。
+     **/
+    // 解码后的路径，不含query string
+    string_view path() const;
+    // query参数，按application/x-www-form-urlencoded解码
+    string_view query(string_view key) const;
+    // cookie请求头中的值
+    string_view cookie(string_view key) const;
+
+    // 懒解析缓存，保存偏移量而非指针，请求在队列间移动后依然有效
+    struct Span {
+      uint8_t source; // 0: target 1: decoded 2: cookie请求头
+      uint32_t offset;
+      uint32_t size;
+    };
+    mutable uint8_t parsed = 0;
+    mutable Span path_span;
+    mutable vector<pair<Span, Span>> query_spans;
+    mutable vector<pair<Span, Span>> cookie_spans;
+    mutable string decoded;
+  };
+  // 连接上请求报文的解析阶段
+  enum class ParseState {
+    HEADER,         // 等待完整的请求头
+    BODY,           // 按content-length读取body
+    CHUNK_SIZE,     // chunked: 读取chunk大小行
+    CHUNK_DATA,     // chunked: 读取chunk数据
+    CHUNK_DATA_END, // chunked: chunk数据后的\r\n
+    CHUNK_TRAILER,  // chunked: 最后的trailer头
+    COMPLETE        // 无body，请求已完整
+  };
+  struct TCPBuffer {
+      int epoll_fd;
+      int fd;
+      size_t len;
+      string content;
+      // 解析状态，body直接解码进req.body，不在content中重复缓存
+      ParseState state = ParseState::HEADER;
+      size_t offset = 0;
+      bool discard = false; // 丢弃当前请求的body
+      size_t trailer_size = 0;   // 已读取的trailer字节数
+      size_t trailer_fields = 0; // 已读取的trailer字段数
+      HTTPRequest req;
   };
   struct HTTPResponse {
     string status_code;
     unordered_map<string, string> headers;
     string body;
+    // 只读的共享body（如静态文件的内存映射），body为空时发送它，不拷贝
+    Slice shared_body;
+    // 发送响应头前依次调用，流式响应在filter链返回前就会发送响应头
+    vector<function<void(HTTPResponse&)>> on_head;
+    // 响应结束（end、close或交给WebSocket/SSE）后调用一次，此时bytes_sent为全部body字节数
+    vector<function<void(HTTPResponse&)>> on_end;
+    // 流式响应body的编码（如压缩），由on_head钩子设置；last为true时返回剩余的全部数据
+    function<string(string_view, bool)> encode;
+    bool head_sent = false;
+    bool finished = false;
+    bool close = false; // 响应后关闭连接
+    uint64_t bytes_sent = 0; // 已交给IO线程的body字节数（编码后）
+    string_view body_view() const {
+      return body.empty() && shared_body.size > 0 ? string_view(shared_body.data, shared_body.size) : string_view(body);
+    }
+    // 取出body交给IO线程或流式发送，两种body都不拷贝数据，之后body为空
+    Slice take_body();
+  };
+  // 响应body的分隔方式
+  enum class BodyFraming {
+    LENGTH,  // content-length为body长度
+    CHUNKED, // transfer-encoding: chunked
+    CLOSE    // 不带长度，以关闭连接结束body（HTTP/1.0的流式响应）
   };
+  // 序列化响应行与响应头
+  string serialize_head(HTTPResponse& response, BodyFraming framing);
+  // HTTP/2响应头的HPACK header block，streaming为false时带content-length
+  string serialize_h2_head(HTTPResponse& response, bool streaming);
   struct Context {
     int epoll_fd;
     int fd;
     HTTPRequest& request;
     HTTPResponse& response;
     unordered_map<string, any> extra;
+    /**
+     * 流式响应：首次调用时以transfer-encoding: chunked发送响应头，之后每次发送一个chunk。
+     * HTTP/1.0请求不支持chunked，直接发送原始数据，结束时关闭连接。
+     * IO线程发送队列超过高水位时阻塞，连接已关闭时返回false。
+     **/
+    bool write(const string& chunk);
+    // 结束响应：未开始流式发送时一次性发送完整响应，否则发送结束chunk
+    void end();
+    // 响应无法正常完成（如流式发送中出错）时直接关闭连接，HTTP/2只中止当前流
+    void close();
+    /**
+     * 同意WebSocket升级：发送101响应，之后该连接的消息交给handler处理。
+     * 握手请求不合法时抛出ServerException，未调用时升级请求按普通响应处理并关闭连接。
+     **/
+    void websocket(WebSocketHandler handler);
+    /**
+     * 以text/event-stream发送响应头并订阅topic，之后topic发布的事件写到该连接。
+     * 响应不会结束，worker立即返回，连接由IO线程定时发送心跳保持。
+     **/
+    void event_stream(const std::shared_ptr<EventTopic>& topic);
+  private:
+    void end_h2();
   };
   struct ServerException {
     string status;
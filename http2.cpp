@@ -0,0 +1,790 @@
+#include <algorithm>
+#include "http2.h"
+#include "parser.h"
+#include "base64.h"
+
+namespace {
+  enum FrameType : uint8_t {
+    FRAME_DATA = 0x0,
+    FRAME_HEADERS = 0x1,
+    FRAME_PRIORITY = 0x2,
+    FRAME_RST_STREAM = 0x3,
+    FRAME_SETTINGS = 0x4,
+    FRAME_PUSH_PROMISE = 0x5,
+    FRAME_PING = 0x6,
+    FRAME_GOAWAY = 0x7,
+    FRAME_WINDOW_UPDATE = 0x8,
+    FRAME_CONTINUATION = 0x9
+  };
+  enum FrameFlag : uint8_t {
+    FLAG_END_STREAM = 0x1,
+    FLAG_ACK = 0x1,
+    FLAG_END_HEADERS = 0x4,
+    FLAG_PADDED = 0x8,
+    FLAG_PRIORITY = 0x20
+  };
+  enum ErrorCode : uint32_t {
+    NO_ERROR = 0x0,
+    PROTOCOL_ERROR = 0x1,
+    INTERNAL_ERROR = 0x2,
+    FLOW_CONTROL_ERROR = 0x3,
+    STREAM_CLOSED = 0x5,
+    FRAME_SIZE_ERROR = 0x6,
+    REFUSED_STREAM = 0x7,
+    COMPRESSION_ERROR = 0x9
+  };
+  const int64_t MAX_WINDOW = 0x7fffffff;
+  // HTTP/2中禁止出现的连接相关头
+  const char* connection_headers[] = {"connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade"};
+
+  uint32_t read_u32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+  }
+
+  void write_u32(std::string& out, uint32_t value) {
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+  }
+
+  std::string frame_header(size_t length, uint8_t type, uint8_t flags, uint32_t stream_id) {
+    std::string header;
+    header.push_back(static_cast<char>(length >> 16));
+    header.push_back(static_cast<char>(length >> 8));
+    header.push_back(static_cast<char>(length));
+    header.push_back(static_cast<char>(type));
+    header.push_back(static_cast<char>(flags));
+    write_u32(header, stream_id & 0x7fffffff);
+    return header;
+  }
+
+  // 去掉PADDED标志带来的填充，出错返回false
+  bool strip_padding(uint8_t flags, const uint8_t*& payload, size_t& length) {
+    if (!(flags & FLAG_PADDED)) {
+      return true;
+    }
+    if (length < 1 || payload[0] >= length) {
+      return false;
+    }
+    size_t pad = payload[0];
+    payload++;
+    length -= 1 + pad;
+    return true;
+  }
+
+  // 将prefilter返回的HTTP/1.1响应报文转换为HTTPResponse，content-length由serialize_h2_head重新生成
+  bool parse_response(std::string_view raw, pulsation::HTTPResponse& response) {
+    size_t head_end = raw.find("\r\n\r\n");
+    size_t line_end = raw.find("\r\n");
+    if (head_end == std::string_view::npos || raw.compare(0, 5, "HTTP/") != 0) {
+      return false;
+    }
+    std::string_view line = raw.substr(0, line_end);
+    size_t space = line.find(' ');
+    if (space == std::string_view::npos || line.size() < space + 4) {
+      return false;
+    }
+    response.status_code = std::string(line.substr(space + 1, 3));
+    size_t pos = line_end + 2;
+    while (pos < head_end) {
+      size_t end = raw.find("\r\n", pos);
+      std::string_view field = raw.substr(pos, end - pos);
+      pos = end + 2;
+      size_t colon = field.find(':');
+      if (colon == std::string_view::npos) {
+        return false;
+      }
+      std::string name(field.substr(0, colon));
+      std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+      std::string_view value = field.substr(colon + 1);
+      while (!value.empty() && value.front() == ' ') {
+        value.remove_prefix(1);
+      }
+      if (name != "content-length") {
+        response.headers[name] = std::string(value);
+      }
+    }
+    response.body = std::string(raw.substr(head_end + 4));
+    return true;
+  }
+
+  bool is_connection_header(const std::string& name) {
+    for (const char* header : connection_headers) {
+      if (name == header) return true;
+    }
+    return false;
+  }
+}
+
+pulsation::Http2Session::Http2Session(std::shared_ptr<Connection> conn, size_t max_body, RequestFunc on_request, HeadFunc on_head, EmitFunc emit)
+  : conn(conn), max_body(max_body), on_request(on_request), on_head(on_head), emit(emit),
+    recv_window_size(std::clamp<int64_t>(max_body, H2_WINDOW_SIZE, MAX_WINDOW)) {}
+
+void pulsation::Http2Session::send_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const std::string& payload) {
+  emit(make_slice(frame_header(payload.size(), type, flags, stream_id) + payload), false);
+}
+
+void pulsation::Http2Session::start() {
+  std::string settings;
+  // SETTINGS_MAX_CONCURRENT_STREAMS
+  settings.push_back(0);
+  settings.push_back(0x3);
+  write_u32(settings, H2_MAX_STREAMS);
+  // SETTINGS_MAX_HEADER_LIST_SIZE
+  settings.push_back(0);
+  settings.push_back(0x6);
+  write_u32(settings, HPACK_MAX_LIST_SIZE);
+  send_frame(FRAME_SETTINGS, 0, 0, settings);
+  // 连接级窗口不受SETTINGS_INITIAL_WINDOW_SIZE影响，只能用WINDOW_UPDATE扩大
+  credit(recv_window_size - H2_WINDOW_SIZE);
+}
+
+void pulsation::Http2Session::goaway(uint32_t error) {
+  std::string payload;
+  write_u32(payload, last_stream_id);
+  write_u32(payload, error);
+  send_frame(FRAME_GOAWAY, 0, 0, payload);
+}
+
+void pulsation::Http2Session::reset(uint32_t stream_id, uint32_t error) {
+  std::string payload;
+  write_u32(payload, error);
+  send_frame(FRAME_RST_STREAM, 0, stream_id, payload);
+  auto it = streams.find(stream_id);
+  if (it != streams.end()) {
+    drop(it->second);
+    streams.erase(it);
+  }
+}
+
+void pulsation::Http2Session::drop(H2Stream& stream) {
+  size_t dropped = 0;
+  for (Slice& slice : stream.data) {
+    dropped += slice.size;
+  }
+  stream.data.clear();
+  conn->consumed(dropped);
+  release(stream);
+}
+
+void pulsation::Http2Session::credit(size_t n) {
+  if (n == 0) {
+    return;
+  }
+  std::string increment;
+  write_u32(increment, n);
+  send_frame(FRAME_WINDOW_UPDATE, 0, 0, increment);
+  recv_window += n;
+}
+
+void pulsation::Http2Session::release(H2Stream& stream) {
+  credit(stream.held);
+  stream.held = 0;
+}
+
+void pulsation::Http2Session::refuse_stalled() {
+  if (recv_window > 0) {
+    return;
+  }
+  // 连接窗口耗尽：有已交给worker的流时，等其处理完归还；
+  // 否则窗口都被尚未接收完整的请求占用，没有流能结束，拒绝缓冲最多的一个，对端可以重试
+  uint32_t refused = 0;
+  size_t most = 0;
+  for (auto& item : streams) {
+    if (item.second.dispatched && item.second.held > 0) {
+      return;
+    }
+    if (item.second.held > most) {
+      refused = item.first;
+      most = item.second.held;
+    }
+  }
+  if (refused != 0) {
+    reset(refused, REFUSED_STREAM);
+  }
+}
+
+bool pulsation::Http2Session::upgrade(HTTPRequest&& req, const std::string& settings) {
+  std::string encoded = settings;
+  std::replace(encoded.begin(), encoded.end(), '-', '+');
+  std::replace(encoded.begin(), encoded.end(), '_', '/');
+  std::string payload = base64_decode(encoded);
+  // HTTP2-Settings头中的设置不需要ACK
+  if (!handle_settings(0, reinterpret_cast<const uint8_t*>(payload.data()), payload.size(), false)) {
+    return false;
+  }
+  // 升级请求成为流1，已处于half-closed(remote)状态
+  last_stream_id = 1;
+  H2Stream& stream = streams[1];
+  stream.send_window = initial_window;
+  stream.remote_closed = true;
+  stream.req = std::move(req);
+  stream.req.protocal = "HTTP/2.0";
+  stream.req.headers.erase("upgrade");
+  stream.req.headers.erase("http2-settings");
+  stream.req.headers.erase("connection");
+  dispatch(1, stream);
+  return true;
+}
+
+bool pulsation::Http2Session::feed(std::string& content) {
+  size_t offset = 0;
+  if (!preface_received) {
+    if (content.size() < H2_PREFACE_SIZE) {
+      return content.compare(0, content.size(), H2_PREFACE, content.size()) == 0;
+    }
+    if (content.compare(0, H2_PREFACE_SIZE, H2_PREFACE) != 0) {
+      goaway(PROTOCOL_ERROR);
+      return false;
+    }
+    preface_received = true;
+    offset = H2_PREFACE_SIZE;
+  }
+  bool ok = true;
+  while (content.size() - offset >= 9) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(content.data()) + offset;
+    size_t length = (size_t(p[0]) << 16) | (size_t(p[1]) << 8) | p[2];
+    if (length > H2_FRAME_SIZE) {
+      goaway(FRAME_SIZE_ERROR);
+      ok = false;
+      break;
+    }
+    if (content.size() - offset < 9 + length) {
+      break;
+    }
+    uint8_t type = p[3];
+    uint8_t flags = p[4];
+    uint32_t stream_id = read_u32(p + 5) & 0x7fffffff;
+    // header block必须由连续的CONTINUATION补全
+    if (header_stream != 0 && (type != FRAME_CONTINUATION || stream_id != header_stream)) {
+      goaway(PROTOCOL_ERROR);
+      ok = false;
+      break;
+    }
+    offset += 9 + length;
+    if (!handle_frame(type, flags, stream_id, p + 9, length)) {
+      ok = false;
+      break;
+    }
+  }
+  content.erase(0, offset);
+  return ok;
+}
+
+bool pulsation::Http2Session::handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t length) {
+  switch (type) {
+    case FRAME_DATA: {
+      if (stream_id == 0) {
+        goaway(PROTOCOL_ERROR);
+        return false;
+      }
+      size_t frame_length = length;
+      // 整个帧（包括填充）计入接收窗口
+      if (static_cast<int64_t>(frame_length) > recv_window) {
+        goaway(FLOW_CONTROL_ERROR);
+        return false;
+      }
+      recv_window -= frame_length;
+      if (!strip_padding(flags, payload, length)) {
+        goaway(PROTOCOL_ERROR);
+        return false;
+      }
+      auto it = streams.find(stream_id);
+      if (it == streams.end()) {
+        if (stream_id > last_stream_id) {
+          goaway(PROTOCOL_ERROR);
+          return false;
+        }
+        // 已重置的流，忽略
+        credit(frame_length);
+        return true;
+      }
+      H2Stream& stream = it->second;
+      if (stream.remote_closed || static_cast<int64_t>(frame_length) > stream.recv_window) {
+        credit(frame_length);
+        reset(stream_id, stream.remote_closed ? STREAM_CLOSED : FLOW_CONTROL_ERROR);
+        return true;
+      }
+      stream.recv_window -= frame_length;
+      if (stream.discard) {
+        credit(frame_length);
+      } else {
+        if (stream.req.body.size() + length > max_body) {
+          credit(frame_length);
+          respond_error(stream_id, stream, ServerException{"413", "Request body too large"});
+          return true;
+        }
+        stream.req.body.append(reinterpret_cast<const char*>(payload), length);
+        stream.held += frame_length;
+      }
+      if (flags & FLAG_END_STREAM) {
+        stream.remote_closed = true;
+        if (stream.discard) {
+          try_close(stream_id);
+        } else {
+          stream.req.headers["content-length"] = std::to_string(stream.req.body.size());
+          dispatch(stream_id, stream);
+        }
+      } else if (frame_length > 0) {
+        // 流级窗口在数据进入body后归还，单个流的body由max_body限制
+        std::string increment;
+        write_u32(increment, frame_length);
+        send_frame(FRAME_WINDOW_UPDATE, 0, stream_id, increment);
+        stream.recv_window += frame_length;
+      }
+      refuse_stalled();
+      return true;
+    }
+    case FRAME_HEADERS: {
+      if (stream_id == 0 || !strip_padding(flags, payload, length)) {
+        goaway(PROTOCOL_ERROR);
+        return false;
+      }
+      if (flags & FLAG_PRIORITY) {
+        if (length < 5) {
+          goaway(PROTOCOL_ERROR);
+          return false;
+        }
+        payload += 5;
+        length -= 5;
+      }
+      header_stream = stream_id;
+      header_end_stream = flags & FLAG_END_STREAM;
+      header_block.assign(reinterpret_cast<const char*>(payload), length);
+      if (flags & FLAG_END_HEADERS) {
+        return handle_headers(stream_id);
+      }
+      return true;
+    }
+    case FRAME_CONTINUATION: {
+      if (header_stream == 0) {
+        goaway(PROTOCOL_ERROR);
+        return false;
+      }
+      header_block.append(reinterpret_cast<const char*>(payload), length);
+      if (header_block.size() > MAX_HEADER_SIZE) {
+        goaway(PROTOCOL_ERROR);
+        return false;
+      }
+      if (flags & FLAG_END_HEADERS) {
+        return handle_headers(stream_id);
+      }
+      return true;
+    }
+    case FRAME_PRIORITY: {
+      if (stream_id == 0) {
+        goaway(PROTOCOL_ERROR);
+        return false;
+      }
+      if (length != 5) {
+        reset(stream_id, FRAME_SIZE_ERROR);
+      }
+      return true;
+    }
+    case FRAME_RST_STREAM: {
+      if (stream_id == 0 || stream_id > last_stream_id) {
+        goaway(PROTOCOL_ERROR);
+        return false;
+      }
+      if (length != 4) {
+        goaway(FRAME_SIZE_ERROR);
+        return false;
+      }
+      auto it = streams.find(stream_id);
+      if (it != streams.end()) {
+        drop(it->second);
+        streams.erase(it);
+      }
+      return true;
+    }
+    case FRAME_SETTINGS: {
+      if (stream_id != 0) {
+        goaway(PROTOCOL_ERROR);
+        return false;
+      }
+      return handle_settings(flags, payload, length);
+    }
+    case FRAME_PING: {
+      if (stream_id != 0) {
+        goaway(PROTOCOL_ERROR);
+        return false;
+      }
+      if (length != 8) {
+        goaway(FRAME_SIZE_ERROR);
+        return false;
+      }
+      if (!(flags & FLAG_ACK)) {
+        send_frame(FRAME_PING, FLAG_ACK, 0, std::string(reinterpret_cast<const char*>(payload), length));
+      }
+      return true;
+    }
+    case FRAME_GOAWAY: {
+      if (stream_id != 0) {
+        goaway(PROTOCOL_ERROR);
+        return false;
+      }
+      // 对端不再发起新的流，已有的流继续处理，由对端关闭连接
+      return true;
+    }
+    case FRAME_WINDOW_UPDATE: {
+      if (length != 4) {
+        goaway(FRAME_SIZE_ERROR);
+        return false;
+      }
+      int64_t increment = read_u32(payload) & 0x7fffffff;
+      if (stream_id == 0) {
+        if (increment == 0 || send_window + increment > MAX_WINDOW) {
+          goaway(increment == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+          return false;
+        }
+        send_window += increment;
+        pump_all();
+        return true;
+      }
+      auto it = streams.find(stream_id);
+      if (it == streams.end()) {
+        return true;
+      }
+      if (increment == 0 || it->second.send_window + increment > MAX_WINDOW) {
+        reset(stream_id, increment == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+        return true;
+      }
+      it->second.send_window += increment;
+      pump(stream_id, it->second);
+      return true;
+    }
+    case FRAME_PUSH_PROMISE: {
+      // 客户端不能推送
+      goaway(PROTOCOL_ERROR);
+      return false;
+    }
+    default:
+      // 未知帧类型直接忽略
+      return true;
+  }
+}
+
+bool pulsation::Http2Session::handle_settings(uint8_t flags, const uint8_t* payload, size_t length, bool ack) {
+  if (flags & FLAG_ACK) {
+    if (length != 0) {
+      goaway(FRAME_SIZE_ERROR);
+      return false;
+    }
+    return true;
+  }
+  if (length % 6 != 0) {
+    goaway(FRAME_SIZE_ERROR);
+    return false;
+  }
+  for (size_t i = 0; i < length; i += 6) {
+    uint16_t id = (uint16_t(payload[i]) << 8) | payload[i + 1];
+    uint32_t value = read_u32(payload + i + 2);
+    if (id == 0x4) {
+      // SETTINGS_INITIAL_WINDOW_SIZE，调整所有流的发送窗口
+      if (value > MAX_WINDOW) {
+        goaway(FLOW_CONTROL_ERROR);
+        return false;
+      }
+      int64_t delta = int64_t(value) - initial_window;
+      for (auto& item : streams) {
+        // 调整后任何流的窗口都不能超过2^31-1
+        if (item.second.send_window + delta > MAX_WINDOW) {
+          goaway(FLOW_CONTROL_ERROR);
+          return false;
+        }
+      }
+      initial_window = value;
+      for (auto& item : streams) {
+        item.second.send_window += delta;
+      }
+    } else if (id == 0x5) {
+      // SETTINGS_MAX_FRAME_SIZE
+      if (value < H2_FRAME_SIZE || value > 0xffffff) {
+        goaway(PROTOCOL_ERROR);
+        return false;
+      }
+      peer_frame_size = value;
+    }
+  }
+  if (ack) {
+    send_frame(FRAME_SETTINGS, FLAG_ACK, 0, "");
+  }
+  pump_all();
+  return true;
+}
+
+bool pulsation::Http2Session::handle_headers(uint32_t stream_id) {
+  header_stream = 0;
+  HeaderList fields;
+  bool oversized;
+  if (!decoder.decode(reinterpret_cast<const uint8_t*>(header_block.data()), header_block.size(), fields, HPACK_MAX_LIST_SIZE, oversized)) {
+    goaway(COMPRESSION_ERROR);
+    return false;
+  }
+  header_block.clear();
+  auto it = streams.find(stream_id);
+  if (it != streams.end()) {
+    // trailer，合并到请求头中
+    H2Stream& stream = it->second;
+    if (stream.remote_closed || !header_end_stream) {
+      goaway(PROTOCOL_ERROR);
+      return false;
+    }
+    stream.remote_closed = true;
+    if (oversized && !stream.discard) {
+      respond_error(stream_id, stream, ServerException{"431", "Request header too large"});
+      return true;
+    }
+    for (auto& field : fields) {
+      if (!field.first.empty() && field.first[0] != ':') {
+        stream.req.headers[field.first] = field.second;
+      }
+    }
+    if (stream.discard) {
+      try_close(stream_id);
+    } else {
+      stream.req.headers["content-length"] = std::to_string(stream.req.body.size());
+      dispatch(stream_id, stream);
+    }
+    return true;
+  }
+  if (stream_id % 2 == 0) {
+    goaway(PROTOCOL_ERROR);
+    return false;
+  }
+  if (stream_id <= last_stream_id) {
+    // 已重置的流，header block已解码以保持HPACK状态，忽略
+    return true;
+  }
+  last_stream_id = stream_id;
+  if (streams.size() >= H2_MAX_STREAMS) {
+    reset(stream_id, REFUSED_STREAM);
+    return true;
+  }
+  H2Stream& stream = streams[stream_id];
+  stream.send_window = initial_window;
+  stream.remote_closed = header_end_stream;
+  if (oversized) {
+    respond_error(stream_id, stream, ServerException{"431", "Request header too large"});
+    return true;
+  }
+  HTTPRequest& req = stream.req;
+  req.protocal = "HTTP/2.0";
+  req.stream_id = stream_id;
+  std::string authority;
+  bool valid = true;
+  for (auto& field : fields) {
+    const std::string& name = field.first;
+    if (name == ":method") {
+      req.method = field.second;
+    } else if (name == ":path") {
+      req.target = field.second;
+    } else if (name == ":authority") {
+      authority = field.second;
+    } else if (name == ":scheme") {
+    } else if (!name.empty() && name[0] == ':') {
+      valid = false;
+    } else if (is_connection_header(name) || std::any_of(name.begin(), name.end(), ::isupper)) {
+      valid = false;
+    } else {
+      auto header = req.headers.find(name);
+      if (header == req.headers.end()) {
+        req.headers.insert(make_pair(name, field.second));
+      } else {
+        // cookie可能被拆成多个字段
+        header->second += (name == "cookie" ? "; " : ", ") + field.second;
+      }
+    }
+  }
+  if (!valid || req.method.empty() || req.target.empty()) {
+    reset(stream_id, PROTOCOL_ERROR);
+    return true;
+  }
+  if (!authority.empty() && req.headers.find("host") == req.headers.end()) {
+    req.headers.insert(make_pair("host", authority));
+  }
+  Slice prefilter_response;
+  try {
+    prefilter_response = on_head(req);
+  } catch (ServerException& e) {
+    respond_error(stream_id, stream, e);
+    return true;
+  }
+  if (prefilter_response.data) {
+    HTTPResponse response;
+    if (!parse_response(std::string_view(prefilter_response.data, prefilter_response.size), response)) {
+      respond_error(stream_id, stream, ServerException{"500", "Invalid prefilter response"});
+    } else {
+      respond(stream_id, stream, response);
+    }
+    return true;
+  }
+  if (stream.remote_closed) {
+    dispatch(stream_id, stream);
+  }
+  return true;
+}
+
+void pulsation::Http2Session::dispatch(uint32_t stream_id, H2Stream& stream) {
+  stream.req.stream_id = stream_id;
+  stream.req.seq = stream_id;
+  stream.req.conn = conn;
+  stream.dispatched = true;
+  on_request(std::move(stream.req));
+  stream.req = HTTPRequest{};
+}
+
+void pulsation::Http2Session::respond_error(uint32_t stream_id, H2Stream& stream, const ServerException& e) {
+  HTTPResponse response;
+  response.status_code = e.status;
+  response.headers = {{"server", "pulsation"}, {"content-type", "text/plain"}};
+  response.body = e.msg;
+  respond(stream_id, stream, response);
+}
+
+void pulsation::Http2Session::respond(uint32_t stream_id, H2Stream& stream, HTTPResponse& response) {
+  stream.discard = true;
+  // 已收到的body不再需要
+  std::string().swap(stream.req.body);
+  release(stream);
+  Slice block = make_slice(serialize_h2_head(response, false));
+  Slice body = response.take_body();
+  // 直接写入发送队列，计入pending后按流量控制发出
+  conn->pending += block.size + body.size;
+  if (body.size > 0) {
+    stream.data.push_back(body);
+    stream.data_last = true;
+  }
+  // 对端已关闭时，发送完成后流会被try_close删除，之后不能再访问stream
+  bool remote_closed = stream.remote_closed;
+  send_headers(stream_id, block, body.size == 0);
+  auto it = streams.find(stream_id);
+  if (it != streams.end() && body.size > 0) {
+    pump(stream_id, it->second);
+    it = streams.find(stream_id);
+  }
+  if (!remote_closed && it != streams.end() && it->second.data.empty()) {
+    // 响应已完整，不再需要请求剩余的body
+    reset(stream_id, NO_ERROR);
+  }
+}
+
+void pulsation::Http2Session::send_headers(uint32_t stream_id, const Slice& block, bool end_stream) {
+  size_t offset = 0;
+  bool first = true;
+  do {
+    size_t n = std::min<size_t>(block.size - offset, peer_frame_size);
+    uint8_t flags = offset + n == block.size ? FLAG_END_HEADERS : 0;
+    if (first && end_stream) {
+      flags |= FLAG_END_STREAM;
+    }
+    emit(make_slice(frame_header(n, first ? FRAME_HEADERS : FRAME_CONTINUATION, flags, stream_id)), false);
+    if (n > 0) {
+      emit(Slice{block.owner, block.data + offset, n}, true);
+    }
+    offset += n;
+    first = false;
+  } while (offset < block.size);
+  if (end_stream) {
+    auto it = streams.find(stream_id);
+    if (it != streams.end()) {
+      it->second.local_closed = true;
+      try_close(stream_id);
+    }
+  }
+}
+
+void pulsation::Http2Session::pump(uint32_t stream_id, H2Stream& stream) {
+  while (!stream.data.empty()) {
+    Slice& front = stream.data.front();
+    bool last = stream.data_last && stream.data.size() == 1;
+    if (front.size == 0) {
+      if (last) {
+        emit(make_slice(frame_header(0, FRAME_DATA, FLAG_END_STREAM, stream_id)), false);
+      }
+      stream.data.pop_front();
+      continue;
+    }
+    int64_t window = std::min(send_window, stream.send_window);
+    if (window <= 0) {
+      return;
+    }
+    size_t n = std::min<size_t>({front.size, static_cast<size_t>(window), peer_frame_size});
+    bool end_stream = last && n == front.size;
+    emit(make_slice(frame_header(n, FRAME_DATA, end_stream ? FLAG_END_STREAM : 0, stream_id)), false);
+    emit(Slice{front.owner, front.data, n}, true);
+    send_window -= n;
+    stream.send_window -= n;
+    front.data += n;
+    front.size -= n;
+    if (front.size == 0) {
+      stream.data.pop_front();
+    }
+  }
+  if (stream.data_last) {
+    stream.local_closed = true;
+    try_close(stream_id);
+  }
+}
+
+void pulsation::Http2Session::pump_all() {
+  for (auto it = streams.begin(); it != streams.end();) {
+    uint32_t stream_id = it->first;
+    H2Stream& stream = it->second;
+    it++;
+    if (!stream.data.empty()) {
+      pump(stream_id, stream);
+    }
+    if (send_window <= 0) {
+      return;
+    }
+  }
+}
+
+void pulsation::Http2Session::try_close(uint32_t stream_id) {
+  auto it = streams.find(stream_id);
+  if (it != streams.end() && it->second.local_closed && it->second.remote_closed && it->second.data.empty()) {
+    // 响应已结束，worker不再使用请求body
+    release(it->second);
+    streams.erase(it);
+  }
+}
+
+void pulsation::Http2Session::on_message(Message& msg) {
+  uint32_t stream_id = msg.seq;
+  auto it = streams.find(stream_id);
+  if (it == streams.end() || it->second.local_closed || it->second.discard) {
+    // 流已被重置或关闭
+    conn->consumed(msg.data.size);
+    return;
+  }
+  H2Stream& stream = it->second;
+  switch (msg.type) {
+    case MSG_H2_HEADERS:
+      send_headers(stream_id, msg.data, msg.last);
+      break;
+    case MSG_H2_DATA:
+      stream.data.push_back(std::move(msg.data));
+      stream.data_last = msg.last;
+      pump(stream_id, stream);
+      break;
+    case MSG_H2_RESET:
+      conn->consumed(msg.data.size);
+      reset(stream_id, INTERNAL_ERROR);
+      break;
+    default:
+      conn->consumed(msg.data.size);
+      break;
+  }
+}
+
+size_t pulsation::Http2Session::buffered() const {
+  size_t size = 0;
+  for (auto& item : streams) {
+    for (const Slice& slice : item.second.data) {
+      size += slice.size;
+    }
+  }
+  return size;
+}
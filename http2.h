@@ -0,0 +1,91 @@
+#pragma once
+#include <map>
+#include <deque>
+#include <string>
+#include <functional>
+#include "http.h"
+#include "hpack.h"
+
+namespace pulsation {
+  #define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+  #define H2_PREFACE_SIZE 24
+  #define H2_FRAME_SIZE 16384
+  #define H2_WINDOW_SIZE 65535
+  #define H2_MAX_STREAMS 100
+  // HTTP/2连接上的一个流
+  struct H2Stream {
+    HTTPRequest req;
+    int64_t send_window;
+    int64_t recv_window = H2_WINDOW_SIZE;
+    size_t held = 0;         // 已进入body、尚未归还连接接收窗口的字节数
+    std::deque<Slice> data;  // 受流量控制限制尚未发出的DATA
+    bool data_last = false;  // data中最后一块带END_STREAM
+    bool remote_closed = false;
+    bool local_closed = false;
+    bool discard = false;    // 已在IO线程中直接响应，忽略后续DATA
+    bool dispatched = false; // 请求已交给worker
+  };
+  /**
+   * 明文HTTP/2(h2c)连接，运行在拥有该连接的IO线程中。
+   * 负责帧的解析与生成、HPACK解码、流的多路复用与双向流量控制，
+   * 完整的请求转换为HTTPRequest交给worker，worker的响应以Message形式交回。
+   **/
+  class Http2Session {
+    public:
+      typedef std::function<void(HTTPRequest&&)> RequestFunc;
+      // 请求头解析完成后的检查（prefilter），抛出ServerException或返回非空的HTTP/1.1响应时在流上直接响应
+      typedef std::function<Slice(HTTPRequest&)> HeadFunc;
+      // 写出数据，counted为true表示已计入连接的pending字节数
+      typedef std::function<void(Slice, bool)> EmitFunc;
+    private:
+      std::shared_ptr<Connection> conn;
+      size_t max_body;
+      RequestFunc on_request;
+      HeadFunc on_head;
+      EmitFunc emit;
+      HpackDecoder decoder;
+      std::map<uint32_t, H2Stream> streams;
+      bool preface_received = false;
+      uint32_t last_stream_id = 0;
+      int64_t send_window = H2_WINDOW_SIZE;
+      int64_t initial_window = H2_WINDOW_SIZE;
+      // 连接级接收窗口：请求body交给worker并处理完才归还，一个连接上缓冲的body不超过recv_window_size
+      int64_t recv_window = H2_WINDOW_SIZE;
+      int64_t recv_window_size;
+      uint32_t peer_frame_size = H2_FRAME_SIZE;
+      // 正在接收的header block（HEADERS + CONTINUATION）
+      uint32_t header_stream = 0;
+      bool header_end_stream = false;
+      std::string header_block;
+
+      void send_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const std::string& payload);
+      void goaway(uint32_t error);
+      void reset(uint32_t stream_id, uint32_t error);
+      bool handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t length);
+      bool handle_headers(uint32_t stream_id);
+      bool handle_settings(uint8_t flags, const uint8_t* payload, size_t length, bool ack = true);
+      void dispatch(uint32_t stream_id, H2Stream& stream);
+      void respond(uint32_t stream_id, H2Stream& stream, HTTPResponse& response);
+      void respond_error(uint32_t stream_id, H2Stream& stream, const ServerException& e);
+      void send_headers(uint32_t stream_id, const Slice& block, bool end_stream);
+      void pump(uint32_t stream_id, H2Stream& stream);
+      void pump_all();
+      void drop(H2Stream& stream);
+      void credit(size_t n);
+      void release(H2Stream& stream);
+      void refuse_stalled();
+      void try_close(uint32_t stream_id);
+    public:
+      Http2Session(std::shared_ptr<Connection> conn, size_t max_body, RequestFunc on_request, HeadFunc on_head, EmitFunc emit);
+      // 发送服务端的SETTINGS，连接切换到HTTP/2时调用一次
+      void start();
+      // h2c Upgrade：HTTP/1.1请求成为流1，settings为HTTP2-Settings头的值
+      bool upgrade(HTTPRequest&& req, const std::string& settings);
+      // 消费收到的数据，返回false表示连接出错，已发送GOAWAY，应在写完后关闭
+      bool feed(std::string& content);
+      // worker交回的响应
+      void on_message(Message& msg);
+      // 尚未写出的DATA字节数
+      size_t buffered() const;
+  };
+}
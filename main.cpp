@@ -1,17 +1,26 @@
 #include <iostream>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <ctime>
 #include <any>
 #include <sstream>
 #include <fstream>
 #include <regex>
+#include <mutex>
+#include <unordered_set>
+#include <thread>
 #include <zlib.h>
-#include <boost/algorithm/string/join.hpp>
 #include <boost/filesystem.hpp>
 #include "http.h"
 #include "filter.h"
 #include "base64.h"
 #include "server.h"
+#include "spool.h"
+#include "clock.h"
+#include "access_log.h"
+#include "cors.h"
+#include "compress.h"
+#include "static_cache.h"
 
 namespace fs = boost::filesystem;
 
@@ -46,8 +55,69 @@ bool check_resource_valid(string parent, string child) {
   return false;
 }
 
-bool check_path_valid(string path, std::regex regex) {
-  return std::regex_search(path, regex);
+// 返回缓存的静态文件，body与缓存共用（大文件为内存映射）不拷贝：If-None-Match匹配时返回304；存在客户端接受的预压缩旁路文件时直接返回，运行时不再压缩
+void serve_static(pulsation::Context& ctx, const pulsation::StaticFile& file) {
+  auto& headers = ctx.response.headers;
+  set_header(headers, "content-type", file.type);
+  set_header(headers, "etag", file.etag);
+  pulsation::Encoding encoding = pulsation::Encoding::IDENTITY;
+  if (file.encodings != 0) {
+    pulsation::add_vary(headers, "Accept-Encoding");
+    auto accept = ctx.request.headers.find("accept-encoding");
+    if (accept != ctx.request.headers.end()) {
+      encoding = pulsation::negotiate_encoding(accept->second, file.encodings);
+    }
+  }
+  if (encoding != pulsation::Encoding::IDENTITY) {
+    // 304也要带上与200相同的ETag
+    pulsation::weaken_etag(headers);
+  }
+  auto match = ctx.request.headers.find("if-none-match");
+  if (match != ctx.request.headers.end() && pulsation::etag_match(match->second, file.etag)) {
+    ctx.response.status_code = "304";
+    return;
+  }
+  ctx.response.status_code = "200";
+  if (encoding != pulsation::Encoding::IDENTITY) {
+    ctx.response.shared_body = file.encoded[static_cast<int>(encoding)];
+    set_header(headers, "content-encoding", pulsation::encoding_name(encoding));
+    return;
+  }
+  ctx.response.shared_body = file.body;
+}
+
+// 共享body可能是静态文件的映射，在用户态读取（采样、压缩）前拷贝到body中，映射的文件被原地截断时返回500而不是因SIGBUS退出
+void own_body(pulsation::HTTPResponse& response) {
+  if (!response.body.empty() || response.shared_body.size == 0) {
+    return;
+  }
+  bool ok = pulsation::copy_mapped(response.shared_body, response.body);
+  response.shared_body = pulsation::Slice{nullptr, nullptr, 0};
+  if (!ok) {
+    response.headers.erase("etag");
+    throw pulsation::ServerException{"500", "File changed while reading"};
+  }
+}
+
+// 模板参数可能来自请求（path、query、cookie），替换前做HTML转义
+string html_escape(const string& value) {
+  string result;
+  result.reserve(value.size());
+  for (char c : value) {
+    switch (c) {
+      case '&': result += "&amp;"; break;
+      case '<': result += "&lt;"; break;
+      case '>': result += "&gt;"; break;
+      case '"': result += "&quot;"; break;
+      case '\'': result += "&#39;"; break;
+      default: result += c;
+    }
+  }
+  return result;
+}
+
+bool check_path_valid(string_view path, const std::regex& regex) {
+  return std::regex_search(path.begin(), path.end(), regex);
 }
 
 template<typename T>
@@ -60,43 +130,52 @@ bool get_and_cast(unordered_map<string, any>& map, string key, T& value) {
 }
 
 bool check_controller(pulsation::HTTPRequest& req, string method, string path) {
-  std::regex regex{path};
-  return req.method == method && check_path_valid(req.path, regex);
-}
-
-int gzcompress(Bytef *data, uLong ndata, Bytef *zdata, uLong *nzdata) {
-  z_stream c_stream;
-  int err = 0;
-  if(data && ndata > 0) {
-      c_stream.zalloc = NULL;
-      c_stream.zfree = NULL;
-      c_stream.opaque = NULL;
-      //只有设置为MAX_WBITS + 16才能在在压缩文本中带header和trailer
-      if(deflateInit2(&c_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
-                      MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return -1;
-      c_stream.next_in  = data;
-      c_stream.avail_in  = ndata;
-      c_stream.next_out = zdata;
-      c_stream.avail_out  = *nzdata;
-      while(c_stream.avail_in != 0 && c_stream.total_out < *nzdata) {
-          if(deflate(&c_stream, Z_NO_FLUSH) != Z_OK) return-1;
-      }
-      if(c_stream.avail_in != 0) return c_stream.avail_in;
-      for(;;) {
-          if((err = deflate(&c_stream, Z_FINISH)) == Z_STREAM_END) break;
-          if(err != Z_OK) return-1;
-      }
-      if(deflateEnd(&c_stream) != Z_OK) return-1;
-      *nzdata = c_stream.total_out;
-      return 0;
+  if (req.method != method) {
+    return false;
+  }
+  // 路由正则只编译一次
+  thread_local unordered_map<string, std::regex> regex_cache;
+  auto it = regex_cache.find(path);
+  if (it == regex_cache.end()) {
+    it = regex_cache.insert(make_pair(path, std::regex{path})).first;
   }
-  return-1;
+  return check_path_valid(req.path(), it->second);
 }
 
+// WebSocket聊天室的在线连接
+struct ChatRoom {
+  std::mutex mutex;
+  vector<pulsation::WebSocketPtr> members;
+};
+
 int main(int, char**) {
     pulsation::Server server{8080, 4};
+    auto room = std::make_shared<ChatRoom>();
+    // 超过1MB的请求体落盘
+    server.spool(1024 * 1024);
+    // 连接事件日志默认关闭，排查问题时打开，例如 server.event_log(pulsation::EventLevel::DEBUG);
+    // 上传前置检查，在IO线程中于body到达前执行，被拒绝的上传不会占用带宽与内存
+    server.prefilter([](pulsation::HTTPRequest& req) {
+      bool has_body = req.headers.find("transfer-encoding") != req.headers.end() ||
+        (req.headers.find("content-length") != req.headers.end() && req.headers["content-length"] != "0");
+      if (has_body && req.method == "POST") {
+        if (req.path() != "/upload") {
+          throw pulsation::ServerException{"404", "404 - Not Found.(From Server pulsation)"};
+        }
+        auto it = req.headers.find("content-length");
+        if (it != req.headers.end() && std::stoull(it->second) > 64 * 1024 * 1024) {
+          throw pulsation::ServerException{"413", "Upload too large"};
+        }
+      }
+      return pulsation::Slice{};
+    });
     // response and error filter
     server.use([](pulsation::FilterProperties& properties, pulsation::Context& ctx, pulsation::NextFunc next) {
+      // 通用响应头，流式响应在next()返回前就会发送响应头，因此在发送前统一设置
+      ctx.response.on_head.push_back([](pulsation::HTTPResponse& response) {
+        set_header(response.headers, "content-type", "text/plain", true);
+        set_header(response.headers, "server", "pulsation");
+      });
       try {
         next();
         // 没有默认为404
@@ -105,145 +184,240 @@ int main(int, char**) {
           ctx.response.body = "404 - Not Found.(From Server pulsation)";
         }
       } catch (pulsation::ServerException& e) {
+        // 响应头已发出，无法再返回错误码
+        if (ctx.response.head_sent) {
+          ctx.close();
+          return;
+        }
         ctx.response.status_code = e.status;
         ctx.response.body = e.msg;
       }
-      
-      // 通用响应头
-      set_header(ctx.response.headers, "content-type", "text/plain", true);
-      set_header(ctx.response.headers, "server", "pulsation");
-      std::ostringstream s_header;
-      s_header << "HTTP/1.1 " << ctx.response.status_code << " " << pulsation::status_codes.at(ctx.response.status_code) << "\r\n";
-      unordered_map<string, string>::iterator h_iter = ctx.response.headers.begin();
-      while(h_iter != ctx.response.headers.end()) {
-        s_header << h_iter->first << ": " << h_iter->second << "\r\n";
-        h_iter++;
-      }
-      s_header << "content-length" << ": " << ctx.response.body.size() << "\r\n";
-      s_header << "\r\n";
-      std::string header = s_header.str();
-      write(ctx.fd, header.c_str(), header.size());
-      write(ctx.fd, ctx.response.body.c_str(), ctx.response.body.size());
+      ctx.end();
     });
-    // log filter
-    server.use([](pulsation::FilterProperties& properties, pulsation::Context& ctx, pulsation::NextFunc next) {
-      std::ostringstream s_log;
-      time_t now = time(0);
-      struct tm  tstruct;
-      char       buf[80];
-      tstruct = *localtime(&now);
-      strftime(buf, sizeof(buf), "%Y-%m-%d %X", &tstruct);
-      s_log << "[Log] " << buf << " [main - thread " << std::this_thread::get_id() << "] ";
-      s_log << ctx.request.method << " " << ctx.request.path << std::endl;
-      std::cout << s_log.str();
+    // log filter，worker只把定长记录放入本线程的环形队列，由后台线程批量写入access.log
+    pulsation::AccessLogOptions log_options;
+    log_options.path = "access.log";
+    // 高负载时可改用二进制格式，用pulsation-logcat离线解码
+    log_options.format = pulsation::AccessLogFormat::TEXT;
+    log_options.max_file_size = 64 * 1024 * 1024;
+    log_options.flush_interval_ms = 200;
+    // 错误与超过100ms的请求总是记录，其余全部记录；高负载时可调大sample_rate或限制每秒条数
+    log_options.sample_rate = 1;
+    log_options.slow_threshold_us = 100 * 1000;
+    log_options.max_per_second = 0;
+    auto access_log = std::make_shared<pulsation::AccessLogger>(log_options);
+    server.use([access_log](pulsation::FilterProperties& properties, pulsation::Context& ctx, pulsation::NextFunc next) {
+      auto start = std::chrono::steady_clock::now();
+      pulsation::HTTPRequest* req = &ctx.request;
+      // 在响应结束时记录：外层filter设置的默认404与异常转换的状态码都已确定，
+      // 流式与并行压缩的响应记录实际发出的字节数与包括发送在内的总耗时；WebSocket与SSE记录到交接为止
+      ctx.response.on_end.push_back([access_log, req, start](pulsation::HTTPResponse& response) {
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        access_log->log(req->method, req->target, std::atoi(response.status_code.c_str()), response.bytes_sent, latency.count());
+      });
       next();
     });
-    // cors filter
-    server.use([](pulsation::FilterProperties& map) {
-      vector<string> allow_methods = {"GET", "POST", "PUT", "DELETE"};
-      map.insert(make_pair("allow_methods", allow_methods));
-      vector<string> allow_headers = {"Content-Type", "Authorization", "Acceprt"};
-      map.insert(make_pair("allow_headers", allow_headers));
-      vector<string> expose_headers;
-      map.insert(make_pair("expose_headers", expose_headers));
-      map.insert(make_pair("credentials", true));
-      map.insert(make_pair("max_age", 5));
-      map.insert(make_pair("origin", string("*")));
-    }, [](pulsation::FilterProperties& properties, pulsation::Context& ctx, pulsation::NextFunc next) {
-      if (ctx.request.headers.find("origin") == ctx.request.headers.end()) {
+    // cors filter，配置在启动时编译，请求中只做查找
+    pulsation::CorsOptions cors_options;
+    cors_options.origins = {"http://localhost:8080", "http://127.0.0.1:8080", "https://*.example.com"};
+    cors_options.allow_methods = {"GET", "POST", "PUT", "DELETE"};
+    cors_options.allow_headers = {"Content-Type", "Authorization", "Accept"};
+    cors_options.credentials = true;
+    cors_options.max_age = 5;
+    auto cors = std::make_shared<const pulsation::CorsPolicy>(cors_options);
+    // 预检请求在IO线程中直接用缓存的响应回复，不进入worker队列，因此在这里记录访问日志
+    server.prefilter([cors, access_log](pulsation::HTTPRequest& req) {
+      auto start = std::chrono::steady_clock::now();
+      pulsation::Slice response = cors->preflight(req);
+      if (response.data) {
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        access_log->log(req.method, req.target, 204, 0, latency.count());
+      }
+      return response;
+    });
+    server.use([cors](pulsation::FilterProperties& properties, pulsation::Context& ctx, pulsation::NextFunc next) {
+      auto origin_it = ctx.request.headers.find("origin");
+      if (origin_it == ctx.request.headers.end()) {
         next();
         return;
       }
-      string origin = ctx.request.headers["origin"];
-      get_and_cast<string>(properties, "origin", origin);
-      if (ctx.request.method != "OPTIONS") {
-        set_header(ctx.response.headers, "access-control-allow-origin", origin);
-        bool credentials = false;
-        get_and_cast<bool>(properties, "credentials", credentials);
-        if (credentials) {
-          set_header(ctx.response.headers, "access-control-allow-credentials", "true");
-        }
-        vector<string> expose_headers;
-        get_and_cast<vector<string>>(properties, "expose_headers", expose_headers);
-        if (expose_headers.size() > 0) {
-          set_header(ctx.response.headers, "access-control-expose-headers", boost::algorithm::join(expose_headers, ","));
-        }
+      const string* allow_origin = cors->allow_origin(origin_it->second);
+      if (allow_origin == nullptr) {
         next();
-      } else {
-        if (ctx.request.headers.find("access-control-request-method") == ctx.request.headers.end()) {
-          next();
-          return;
-        }
-        set_header(ctx.response.headers, "access-control-allow-origin", origin);
-        bool credentials = false;
-        get_and_cast<bool>(properties, "credentials", credentials);
-        if (credentials) {
-          set_header(ctx.response.headers, "access-control-allow-credentials", "true");
+        return;
+      }
+      auto& headers = ctx.response.headers;
+      if (ctx.request.method != "OPTIONS") {
+        set_header(headers, "access-control-allow-origin", *allow_origin);
+        if (allow_origin == &origin_it->second) {
+          pulsation::add_vary(headers, "Origin");
         }
-        int max_age;
-        bool has_value = get_and_cast<int>(properties, "max_age", max_age);
-        if (has_value) {
-          set_header(ctx.response.headers, "access-control-max-age", std::to_string(max_age));
+        if (cors->credentials()) {
+          set_header(headers, "access-control-allow-credentials", "true");
         }
-        vector<string> allow_methods;
-        get_and_cast<vector<string>>(properties, "allow_methods", allow_methods);
-        if (allow_methods.size() > 0) {
-          set_header(ctx.response.headers, "access-control-allow-methods", boost::algorithm::join(allow_methods, ","));
+        if (!cors->expose_headers().empty()) {
+          set_header(headers, "access-control-expose-headers", cors->expose_headers());
         }
-        vector<string> allow_headers;
-        has_value = get_and_cast<vector<string>>(properties, "allow_headers", allow_headers);
-        if (!has_value) {
-          set_header(ctx.response.headers, "access-control-allow-headers", ctx.request.headers["access-control-allow-headers"]);
+        next();
+        return;
+      }
+      vector<pair<string, string>> preflight;
+      if (!cors->preflight_headers(ctx.request, preflight)) {
+        next();
+        return;
+      }
+      for (auto& header : preflight) {
+        if (header.first == "vary") {
+          pulsation::add_vary(headers, header.second);
         } else {
-          set_header(ctx.response.headers, "access-control-allow-methods", boost::algorithm::join(allow_methods, ","));
+          set_header(headers, header.first, header.second);
         }
-        ctx.response.status_code = "204";
       }
-
+      ctx.response.status_code = "204";
     });
-    // compress filter
+    // compress filter，相同内容的响应直接复用缓存的压缩结果
+    auto compress_cache = std::make_shared<pulsation::CompressCache>();
     server.use([](pulsation::FilterProperties& map) {
-      // 需要压缩的mime types
-      vector<string> mime_types = {"text/html", "image/jpeg", "application/x-javascript", "text/css", "image/png"};
+      // 总是压缩的文本类型；未列出的类型若不是图片、音视频等已压缩格式，按采样结果决定
+      unordered_set<string> mime_types = {"text/html", "text/css", "text/plain", "text/xml", "application/x-javascript",
+        "application/javascript", "application/json", "image/svg+xml"};
       map.insert(make_pair("mime_types", mime_types));
-    }, [](pulsation::FilterProperties& properties, pulsation::Context& ctx, pulsation::NextFunc next) {
+      map.insert(make_pair("min_size", size_t(COMPRESS_MIN_SIZE)));
+      // 按类型设置各编码的压缩级别，未列出的类型与未设置的编码使用默认级别
+      unordered_map<string, pulsation::CompressLevels> levels;
+      levels["application/json"].zstd = 6;
+      levels["application/json"].brotli = 6;
+      levels["text/css"].brotli = 9;
+      levels["application/javascript"].brotli = 9;
+      for (auto& item : levels) {
+        item.second.clamp();
+      }
+      map.insert(make_pair("levels", levels));
+      // 流式响应累计多少字节做一次Z_SYNC_FLUSH，0表示每次write都刷新
+      map.insert(make_pair("stream_flush", size_t(0)));
+    }, [compress_cache](pulsation::FilterProperties& properties, pulsation::Context& ctx, pulsation::NextFunc next) {
+      pulsation::HTTPRequest* req = &ctx.request;
+      pulsation::FilterProperties* props = &properties;
+      // 流式响应在发出响应头时决定是否压缩；finished表示body不会经过write，留给filter返回后处理
+      ctx.response.on_head.push_back([req, props](pulsation::HTTPResponse& response) {
+        if (response.finished || response.encode) {
+          return;
+        }
+        auto& headers = response.headers;
+        auto type_it = headers.find("content-type");
+        if (type_it == headers.end() || headers.find("content-encoding") != headers.end()) {
+          return;
+        }
+        // 流式响应无法预先采样，只压缩配置中列出的类型
+        const auto& mime_types = *std::any_cast<unordered_set<string>>(&(*props)["mime_types"]);
+        if (mime_types.find(string(pulsation::mime_type(type_it->second))) == mime_types.end()) {
+          return;
+        }
+        pulsation::add_vary(headers, "Accept-Encoding");
+        auto accept_it = req->headers.find("accept-encoding");
+        // 增量压缩只实现了gzip
+        if (accept_it == req->headers.end() ||
+            pulsation::negotiate_encoding(accept_it->second, pulsation::encoding_bit(pulsation::Encoding::GZIP)) != pulsation::Encoding::GZIP) {
+          return;
+        }
+        auto encoder = std::make_shared<pulsation::GzipStreamEncoder>(Z_DEFAULT_COMPRESSION, std::any_cast<size_t>((*props)["stream_flush"]));
+        if (!encoder->ok()) {
+          return;
+        }
+        headers["content-encoding"] = "gzip";
+        pulsation::weaken_etag(headers);
+        response.encode = [encoder](string_view data, bool last) {
+          return encoder->encode(data, last);
+        };
+      });
       next();
-      if (ctx.response.headers.find("content-type") != ctx.response.headers.end()) {
-        string header = ctx.response.headers["content-type"];
-        vector<string> mime_types;
-        get_and_cast(properties, "mime_types", mime_types);
-        if (std::find(mime_types.begin(), mime_types.end(), header) != mime_types.end()) {
-          // 压缩
-          Bytef* body = (Bytef*)ctx.response.body.data();
-          uLong len = compressBound(ctx.response.body.size());
-          Bytef compressed[len];
-          int err = gzcompress(body, ctx.response.body.size(), compressed, &len);
-          ctx.response.body = string(reinterpret_cast<char*>(compressed), len);
-          set_header(ctx.response.headers, "content-encoding", "gzip");
+      // 流式响应的body已经发出
+      if (ctx.response.head_sent) {
+        return;
+      }
+      auto& headers = ctx.response.headers;
+      auto type_it = headers.find("content-type");
+      if (type_it == headers.end() || headers.find("content-encoding") != headers.end() ||
+          ctx.response.body_view().size() < std::any_cast<size_t>(properties["min_size"])) {
+        return;
+      }
+      string_view mime = pulsation::mime_type(type_it->second);
+      const auto& mime_types = *std::any_cast<unordered_set<string>>(&properties["mime_types"]);
+      if (mime_types.find(string(mime)) == mime_types.end()) {
+        if (pulsation::is_precompressed_type(mime)) {
+          return;
         }
+        own_body(ctx.response);
+        if (!pulsation::looks_compressible(ctx.response.body_view())) {
+          return;
+        }
+      }
+      // 可压缩的响应随Accept-Encoding变化，缓存需要区分
+      pulsation::add_vary(headers, "Accept-Encoding");
+      auto accept_it = ctx.request.headers.find("accept-encoding");
+      if (accept_it == ctx.request.headers.end()) {
+        return;
+      }
+      // 分段与并行压缩只实现了gzip
+      bool large = ctx.response.body_view().size() > COMPRESS_STREAM_THRESHOLD;
+      pulsation::Encoding encoding = pulsation::negotiate_encoding(accept_it->second,
+        large ? pulsation::encoding_bit(pulsation::Encoding::GZIP) : pulsation::runtime_encodings());
+      if (encoding == pulsation::Encoding::IDENTITY) {
+        return;
+      }
+      own_body(ctx.response);
+      if (ctx.response.body_view().size() > COMPRESS_PARALLEL_THRESHOLD && pulsation::CompressPool::shared().size() > 1) {
+        // 更大的body分块并行压缩，按顺序边压缩边发送；单核时并行没有收益
+        set_header(headers, "content-encoding", "gzip");
+        pulsation::weaken_etag(headers);
+        pulsation::Slice body = ctx.response.take_body();
+        bool ok = pulsation::parallel_gzip(string_view(body.data, body.size), [&ctx](string&& data) {
+          return ctx.write(data);
+        });
+        // 压缩或发送中途失败，已发出的gzip流不完整，不能当作正常结束
+        if (!ok) {
+          ctx.close();
+        }
+        return;
+      }
+      if (large) {
+        // 超大body分段压缩并以chunked发出，不需要与body等长的输出缓冲，第一段压缩完即开始发送
+        auto encoder = std::make_shared<pulsation::GzipStreamEncoder>(Z_DEFAULT_COMPRESSION, SIZE_MAX);
+        if (!encoder->ok()) {
+          return;
+        }
+        set_header(headers, "content-encoding", "gzip");
+        pulsation::weaken_etag(headers);
+        ctx.response.encode = [encoder](string_view data, bool last) {
+          return encoder->encode(data, last);
+        };
+        pulsation::Slice body = ctx.response.take_body();
+        for (size_t offset = 0; offset < body.size; offset += COMPRESS_STREAM_BLOCK) {
+          if (!ctx.write(string(body.data + offset, std::min<size_t>(COMPRESS_STREAM_BLOCK, body.size - offset)))) {
+            return;
+          }
+        }
+        return;
+      }
+      const auto& levels = *std::any_cast<unordered_map<string, pulsation::CompressLevels>>(&properties["levels"]);
+      auto level_it = levels.find(string(mime));
+      int level = (level_it == levels.end() ? pulsation::CompressLevels{} : level_it->second).level(encoding);
+      if (compress_cache->compress(ctx.response.body_view(), ctx.response.body, encoding, level)) {
+        set_header(headers, "content-encoding", pulsation::encoding_name(encoding));
+        pulsation::weaken_etag(headers);
       }
     });
-    // static filter
+    // static filter，文件内容与元数据缓存在内存中，由inotify监听静态目录的变化
+    auto static_cache = std::make_shared<pulsation::StaticCache>("./static");
     server.use([](pulsation::FilterProperties& map) {
-      // 静态目录配置
-      map.insert(make_pair("dir", std::string("./static")));
       // 是否处理错误页面
       map.insert(make_pair("error_handle_page", true));
-    }, [](pulsation::FilterProperties& properties, pulsation::Context& ctx, pulsation::NextFunc next) {
+    }, [static_cache](pulsation::FilterProperties& properties, pulsation::Context& ctx, pulsation::NextFunc next) {
       if (ctx.request.method == "GET") {
-        std::string base_dir = std::any_cast<std::string>(properties["dir"]);
         bool error_handle_page = std::any_cast<bool>(properties["error_handle_page"]);
-        std::string path = base_dir + ctx.request.path;
-        fs::path abs_p(path);
-        if (check_resource_valid(base_dir, path)) {
-          ctx.response.body = read_file_content(path);
-          string ext = abs_p.extension().string();
-          string type = "text/plain";
-          if (pulsation::ext_type.find(ext) != pulsation::ext_type.end()) {
-            type = pulsation::ext_type.at(ext);
-          }
-          set_header(ctx.response.headers, "content-type", type);
-          ctx.response.status_code = "200";
+        auto file = static_cache->get(ctx.request.path());
+        if (file) {
+          serve_static(ctx, *file);
           // 直接返回，不交给后续Filter处理
           return;
         }
@@ -258,8 +432,10 @@ int main(int, char**) {
             set_header(ctx.response.headers, "location", "/404.html");
             return;
           } else if (ctx.response.status_code.find("5", 0) == 0) {
-            if (check_resource_valid(base_dir, base_dir + "/50x.html")) {
-              ctx.response.body = read_file_content(base_dir + "/50x.html");
+            auto page = static_cache->get("/50x.html");
+            if (page) {
+              ctx.response.body.clear();
+              ctx.response.shared_body = page->body;
               set_header(ctx.response.headers, "content-type", "text/html");
               ctx.response.status_code = "200";
               return;
@@ -282,8 +458,8 @@ int main(int, char**) {
       // map.insert(make_pair("fail_jump", string("/login.html")));
       map.insert(make_pair("fail_jump", string("")));
     }, [](pulsation::FilterProperties& map, pulsation::Context& ctx, pulsation::NextFunc next) {
-      string path = ctx.request.path;
-      std::regex path_regexp = std::any_cast<std::regex>(map["path"]);
+      string_view path = ctx.request.path();
+      const std::regex& path_regexp = *std::any_cast<std::regex>(&map["path"]);
       string fail_jump = std::any_cast<string>(map["fail_jump"]);
       bool success = false;
       if (check_path_valid(path, path_regexp)) {
@@ -332,7 +508,15 @@ int main(int, char**) {
             auto it = tpl_params.begin();
             while (it != tpl_params.end()) {
               std::regex regex{"\\$\\{" + it->first + "\\}"};
-              tpl = std::regex_replace(tpl, regex, it->second);
+              // 替换串中的$会被regex_replace展开（$&、$1等），转义为$$按字面输出
+              string value;
+              for (char c : html_escape(it->second)) {
+                value += c;
+                if (c == '$') {
+                  value += '$';
+                }
+              }
+              tpl = std::regex_replace(tpl, regex, value);
               it++;
             }
             ctx.response.body = tpl;
@@ -349,27 +533,103 @@ int main(int, char**) {
       }
     });
     // controller 动态页面
-    server.use([](pulsation::FilterProperties& properties, pulsation::Context& ctx, pulsation::NextFunc next) {
-      if (check_controller(ctx.request, "GET", "/(.*)")) {
+    server.use([room, compress_cache, static_cache](pulsation::FilterProperties& properties, pulsation::Context& ctx, pulsation::NextFunc next) {
+      if (check_controller(ctx.request, "GET", "^/chat$")) {
+        // WebSocket聊天室，消息只序列化一次，广播给所有在线连接
+        pulsation::WebSocketHandler handler;
+        handler.on_open = [room](const pulsation::WebSocketPtr& ws) {
+          std::lock_guard<std::mutex> lock(room->mutex);
+          room->members.push_back(ws);
+        };
+        handler.on_message = [room](const pulsation::WebSocketPtr&, uint8_t opcode, string& data) {
+          vector<pulsation::WebSocketPtr> members;
+          {
+            std::lock_guard<std::mutex> lock(room->mutex);
+            members = room->members;
+          }
+          pulsation::broadcast(members, opcode, data);
+        };
+        handler.on_close = [room](const pulsation::WebSocketPtr& ws, uint16_t) {
+          std::lock_guard<std::mutex> lock(room->mutex);
+          room->members.erase(std::remove(room->members.begin(), room->members.end(), ws), room->members.end());
+        };
+        ctx.websocket(handler);
+      } else if (check_controller(ctx.request, "GET", "^/events$")) {
+        // SSE，订阅后worker立即返回
+        ctx.event_stream(pulsation::event_topic("clock"));
+      } else if (check_controller(ctx.request, "GET", "^/stream$")) {
+        // 流式响应，边生成边发送
+        ctx.response.status_code = "200";
+        for (int i = 0; i < 100; ++i) {
+          if (!ctx.write("line " + std::to_string(i) + "\n")) {
+            return;
+          }
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+      } else if (check_controller(ctx.request, "POST", "^/upload$")) {
+        // 请求体可能已落盘，统一按流读取
+        pulsation::BodyStream stream{ctx.request};
+        char buf[8192];
+        size_t total = 0, count;
+        uLong crc = crc32(0L, Z_NULL, 0);
+        while ((count = stream.read(buf, sizeof(buf))) > 0) {
+          crc = crc32(crc, reinterpret_cast<Bytef*>(buf), count);
+          total += count;
+        }
+        std::ostringstream s_res;
+        s_res << "received " << total << " bytes, crc32 " << std::hex << crc << (ctx.request.body_file ? " (spooled)" : "");
+        ctx.response.body = s_res.str();
+        ctx.response.status_code = "200";
+      } else if (check_controller(ctx.request, "GET", "^/metrics$")) {
+        pulsation::CompressCacheStats stats = compress_cache->stats();
+        std::ostringstream s_res;
+        s_res << "compress_cache_hits " << stats.hits << "\n"
+          << "compress_cache_misses " << stats.misses << "\n"
+          << "compress_cache_evictions " << stats.evictions << "\n"
+          << "compress_cache_entries " << stats.entries << "\n"
+          << "compress_cache_bytes " << stats.bytes << "\n";
+        pulsation::StaticCacheStats static_stats = static_cache->stats();
+        s_res << "static_cache_hits " << static_stats.hits << "\n"
+          << "static_cache_misses " << static_stats.misses << "\n"
+          << "static_cache_evictions " << static_stats.evictions << "\n"
+          << "static_cache_invalidations " << static_stats.invalidations << "\n"
+          << "static_cache_entries " << static_stats.entries << "\n"
+          << "static_cache_bytes " << static_stats.bytes << "\n"
+          << "static_cache_mappings " << static_stats.mappings << "\n";
+        ctx.response.body = s_res.str();
+        ctx.response.status_code = "200";
+      } else if (check_controller(ctx.request, "GET", "/(.*)")) {
         unordered_map<string, string> params;
-        time_t now = time(0);
-        struct tm  tstruct;
-        char       buf[80];
-        tstruct = *localtime(&now);
-        strftime(buf, sizeof(buf), "%Y-%m-%d %X", &tstruct);
-        params.insert(make_pair("now", string(buf)));
+        params.insert(make_pair("now", string(pulsation::Clock::log_time())));
         stringstream ss;
         ss << std::this_thread::get_id();
         params.insert(make_pair("thread_id", ss.str()));
         params.insert(make_pair("method", ctx.request.method));
-        params.insert(make_pair("path",  ctx.request.path));
+        params.insert(make_pair("path",  string(ctx.request.path())));
         params.insert(make_pair("protocal",  ctx.request.protocal));
+        // query参数与cookie只在用到时才解析
+        string_view name = ctx.request.query("name");
+        if (name.data() == nullptr) {
+          name = ctx.request.cookie("name");
+        }
+        params.insert(make_pair("name", name.empty() ? string("guest") : string(name)));
         ctx.extra.insert(make_pair("tpl_path", string("/dynamic.html")));
         ctx.extra.insert(make_pair("tpl_params", params));
       } else {
         next();
       }
     });
-  
+    // 每秒向/events的订阅者推送一次时间，每条事件只编码一次
+    std::thread([] {
+      auto clock = pulsation::event_topic("clock");
+      while (1) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        if (clock->size() == 0) {
+          continue;
+        }
+        clock->publish(string(pulsation::Clock::log_time()), "tick");
+      }
+    }).detach();
+
     server.run();
 }
@@ -0,0 +1,218 @@
+#include <string>
+#include <sstream>
+#include <boost/algorithm/string.hpp>
+#include "parser.h"
+
+namespace {
+  void parse_header_line(const std::string& line, unordered_map<string, string>& headers) {
+    std::string::size_type index = line.find(':', 0);
+    if (index != std::string::npos) {
+      std::string key = boost::algorithm::to_lower_copy(boost::algorithm::trim_copy(line.substr(0, index)));
+      headers.insert(make_pair(key, boost::algorithm::trim_copy(line.substr(index + 1))));
+    }
+  }
+
+  void parse_head(const std::string& head, pulsation::HTTPRequest& req) {
+    std::istringstream s_buf(head);
+    s_buf >> req.method;
+    s_buf >> req.target;
+    s_buf >> req.protocal;
+    if (req.method.empty() || req.target.empty() || req.protocal.empty()) {
+      throw pulsation::ServerException{"400", "Malformed request line"};
+    }
+    std::string header;
+    std::getline(s_buf, header);
+    while (std::getline(s_buf, header)) {
+      parse_header_line(header, req.headers);
+    }
+  }
+
+  // 解析chunk大小行，忽略chunk扩展（;之后的内容）
+  size_t parse_chunk_size(const std::string& line) {
+    std::string size = line.substr(0, line.find(';'));
+    boost::algorithm::trim(size);
+    if (size.empty() || size.size() > 15) {
+      throw pulsation::ServerException{"400", "Malformed chunk size"};
+    }
+    size_t value = 0;
+    for (char c : size) {
+      if (!isxdigit(static_cast<unsigned char>(c))) {
+        throw pulsation::ServerException{"400", "Malformed chunk size"};
+      }
+      value = value * 16 + (isdigit(static_cast<unsigned char>(c)) ? c - '0' : (tolower(c) - 'a' + 10));
+    }
+    return value;
+  }
+
+  size_t body_size(const pulsation::HTTPRequest& req) {
+    return req.body_file ? req.body_file->size() : req.body.size();
+  }
+
+  size_t max_body(const pulsation::ParserLimits& limits) {
+    return limits.spool_threshold > 0 ? limits.max_spool_body : limits.max_body;
+  }
+
+  void append_body(pulsation::HTTPRequest& req, const char* data, size_t n, const pulsation::ParserLimits& limits) {
+    if (!req.body_file && limits.spool_threshold > 0 && req.body.size() + n > limits.spool_threshold) {
+      // chunked请求体超过阈值，已收到的部分转移到文件中
+      req.body_file = pulsation::BodyFile::create(limits.spool_dir);
+      req.body_file->append(req.body.data(), req.body.size());
+      string().swap(req.body);
+    }
+    if (req.body_file) {
+      req.body_file->append(data, n);
+    } else {
+      req.body.append(data, n);
+    }
+  }
+
+  pulsation::ParseResult parse_step(pulsation::TCPBuffer& buf, const pulsation::ParserLimits& limits) {
+    using pulsation::ParseState;
+    std::string& content = buf.content;
+    pulsation::HTTPRequest& req = buf.req;
+    while (1) {
+      switch (buf.state) {
+        case ParseState::HEADER: {
+          std::string::size_type position = content.find("\r\n\r\n", buf.offset);
+          if (position == std::string::npos) {
+            if (content.size() - buf.offset > MAX_HEADER_SIZE) {
+              throw pulsation::ServerException{"431", "Request header too large"};
+            }
+            return pulsation::ParseResult::AGAIN;
+          }
+          parse_head(content.substr(buf.offset, position + 2 - buf.offset), req);
+          buf.offset = position + 4;
+          auto te = req.headers.find("transfer-encoding");
+          if (te != req.headers.end()) {
+            std::string coding = boost::algorithm::trim_copy(boost::algorithm::to_lower_copy(te->second));
+            // 只解码chunked，其他编码（如"gzip, chunked"）剥掉chunked后仍是编码过的数据，不能当作原始body交给handler
+            if (coding != "chunked") {
+              throw pulsation::ServerException{"501", "Unsupported transfer encoding"};
+            }
+            // 同时存在时以transfer-encoding为准
+            req.headers.erase("content-length");
+            buf.state = ParseState::CHUNK_SIZE;
+            return pulsation::ParseResult::HEAD;
+          }
+          auto cl = req.headers.find("content-length");
+          if (cl != req.headers.end()) {
+            try {
+              buf.len = std::stoull(cl->second);
+            } catch (...) {
+              throw pulsation::ServerException{"400", "Malformed content-length"};
+            }
+            if (buf.len > max_body(limits)) {
+              throw pulsation::ServerException{"413", "Request body too large"};
+            }
+          }
+          buf.state = buf.len == 0 ? ParseState::COMPLETE : ParseState::BODY;
+          return pulsation::ParseResult::HEAD;
+        }
+        case ParseState::COMPLETE:
+          return pulsation::ParseResult::DONE;
+        case ParseState::BODY:
+        case ParseState::CHUNK_DATA: {
+          size_t n = std::min(buf.len, content.size() - buf.offset);
+          if (buf.discard) {
+            // 已由prefilter直接响应，body只消费不保存
+          } else if (buf.state == ParseState::BODY && !req.body_file && req.body.empty()) {
+            // 头部检查通过后才分配body空间
+            if (limits.spool_threshold > 0 && buf.len > limits.spool_threshold) {
+              req.body_file = pulsation::BodyFile::create(limits.spool_dir);
+            } else {
+              req.body.reserve(buf.len);
+            }
+          }
+          if (!buf.discard) {
+            append_body(req, content.data() + buf.offset, n, limits);
+          }
+          buf.offset += n;
+          buf.len -= n;
+          if (buf.len > 0) {
+            return pulsation::ParseResult::AGAIN;
+          }
+          if (buf.state == ParseState::BODY) {
+            return pulsation::ParseResult::DONE;
+          }
+          buf.state = ParseState::CHUNK_DATA_END;
+          break;
+        }
+        case ParseState::CHUNK_SIZE: {
+          std::string::size_type position = content.find("\r\n", buf.offset);
+          if (position == std::string::npos) {
+            if (content.size() - buf.offset > MAX_CHUNK_LINE) {
+              throw pulsation::ServerException{"400", "Malformed chunk size"};
+            }
+            return pulsation::ParseResult::AGAIN;
+          }
+          size_t size = parse_chunk_size(content.substr(buf.offset, position - buf.offset));
+          buf.offset = position + 2;
+          if (size == 0) {
+            buf.trailer_size = 0;
+            buf.trailer_fields = 0;
+            buf.state = ParseState::CHUNK_TRAILER;
+            break;
+          }
+          if (body_size(req) + size > max_body(limits)) {
+            throw pulsation::ServerException{"413", "Request body too large"};
+          }
+          buf.len = size;
+          buf.state = ParseState::CHUNK_DATA;
+          break;
+        }
+        case ParseState::CHUNK_DATA_END: {
+          if (content.size() - buf.offset < 2) {
+            return pulsation::ParseResult::AGAIN;
+          }
+          if (content.compare(buf.offset, 2, "\r\n") != 0) {
+            throw pulsation::ServerException{"400", "Malformed chunk"};
+          }
+          buf.offset += 2;
+          buf.state = ParseState::CHUNK_SIZE;
+          break;
+        }
+        case ParseState::CHUNK_TRAILER: {
+          // trailer整体与请求头共用大小上限，逐行读取时累计
+          std::string::size_type position = content.find("\r\n", buf.offset);
+          if (position == std::string::npos) {
+            if (buf.trailer_size + content.size() - buf.offset > MAX_HEADER_SIZE) {
+              throw pulsation::ServerException{"431", "Request header too large"};
+            }
+            return pulsation::ParseResult::AGAIN;
+          }
+          buf.trailer_size += position + 2 - buf.offset;
+          if (buf.trailer_size > MAX_HEADER_SIZE) {
+            throw pulsation::ServerException{"431", "Request header too large"};
+          }
+          std::string line = content.substr(buf.offset, position - buf.offset);
+          buf.offset = position + 2;
+          if (!line.empty()) {
+            if (++buf.trailer_fields > MAX_TRAILER_FIELDS) {
+              throw pulsation::ServerException{"431", "Request header too large"};
+            }
+            parse_header_line(line, req.headers);
+            break;
+          }
+          // 解码完成后按普通请求交给后续filter
+          req.headers.erase("transfer-encoding");
+          req.headers["content-length"] = std::to_string(body_size(req));
+          return pulsation::ParseResult::DONE;
+        }
+      }
+    }
+  }
+}
+
+pulsation::ParseResult pulsation::parse_request(TCPBuffer& buf, HTTPRequest& req, const ParserLimits& limits) {
+  ParseResult result = parse_step(buf, limits);
+  // 丢弃已消费的数据
+  buf.content.erase(0, buf.offset);
+  buf.offset = 0;
+  if (result == ParseResult::DONE) {
+    req = std::move(buf.req);
+    buf.req = HTTPRequest{};
+    buf.state = ParseState::HEADER;
+    buf.len = 0;
+  }
+  return result;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "http.h"
+#include "spool.h"
+
+namespace pulsation {
+  #define MAX_HEADER_SIZE (64 * 1024)
+  #define MAX_BODY_SIZE (16 * 1024 * 1024)
+  #define MAX_CHUNK_LINE 1024
+  #define MAX_TRAILER_FIELDS 100
+  struct ParserLimits {
+    size_t max_body = MAX_BODY_SIZE;  // 内存中body的上限
+    size_t spool_threshold = 0;       // 超过该大小的body边接收边落盘，0表示不落盘
+    size_t max_spool_body = MAX_SPOOL_BODY_SIZE;
+    string spool_dir = "/tmp";
+  };
+  enum class ParseResult {
+    AGAIN, // 需要更多数据
+    HEAD,  // 请求头解析完成、body尚未读取，此时可通过buf.req检查请求
+    DONE   // 请求完整，已移出到req
+  };
+  /**
+   * 增量解析连接缓冲区中的请求，可多次调用，每次只消费已到达的数据。
+   * 每个请求先返回一次HEAD，之后返回DONE；buf.discard为true时body只消费不保存，由调用方在DONE后清除。
+   * 报文非法或超出大小限制时抛出ServerException。
+   **/
+  ParseResult parse_request(TCPBuffer& buf, HTTPRequest& req, const ParserLimits& limits);
+}
@@ -13,8 +13,11 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
 #include <boost/algorithm/string.hpp>
 #include "server.h"
+#include "parser.h"
 
 
 pulsation::Server::Server(unsigned int port, int work_threads): port(port), threads(4), work_threads(work_threads) {
@@ -51,15 +54,20 @@ pulsation::Server::~Server() {
     workers.pop_back();
     delete worker;
   }
+  while (!io_threads.empty()) {
+    delete io_threads.back();
+    io_threads.pop_back();
+  }
 }
 
-void pulsation::Server::process() {
+void pulsation::Server::process(IOThread& io) {
   struct epoll_event ev, events[MAX_EVENTS];
   int epoll_fd = epoll_create1(0);
   if (epoll_fd < 0) {
     perror("Error create epoll");
     exit(1);
   }
+  io.epoll_fd = epoll_fd;
 
   // 监听端口
   ev.data.fd = sockfd;
@@ -68,14 +76,16 @@ void pulsation::Server::process() {
     perror("Error bind listen epoll");
     exit(1);
   }
+  // 监听worker发回的响应数据
+  ev.data.fd = io.channel.event_fd;
+  ev.events = EPOLLIN;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, io.channel.event_fd, &ev) < 0) {
+    perror("Error bind channel epoll");
+    exit(1);
+  }
 
   bool has_listen_event = true;
-  struct sockaddr_in client_address;
-  socklen_t client_len;
-  char client_addr[32];
-  std::unordered_map<int, TCPBuffer> fd_map;
-  std::unordered_map<int, time_t> time_map;
-  char buf[1024];
+  std::time_t last_sweep = time(0);
 
   std::cout << "Sub thread " << std::this_thread::get_id() << " start working..." << std::endl;
   while (1) {
@@ -103,135 +113,545 @@ void pulsation::Server::process() {
 
     int readys = epoll_wait(epoll_fd, events, MAX_EVENTS, EVENT_WAIT_TIMEOUT);
     if (readys == -1) {
+      if (errno == EINTR) continue;
       perror("Error epoll wait");
       exit(1);
     }
     for (int i = 0; i < readys; ++i) {
-      if (events[i].data.fd == sockfd) {
-        int client_fd = accept(sockfd, (struct sockaddr *)&client_address, &client_len);
-        if (client_fd < 0) {
-          perror("Accept socket error!");
+      int fd = events[i].data.fd;
+      if (fd == sockfd) {
+        accept_connection(io);
+      } else if (fd == io.channel.event_fd) {
+        drain_channel(io);
+      } else {
+        if (events[i].events & EPOLLERR) {
+          int error = 0;
+          socklen_t len = sizeof(error);
+          getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+          close_connection(io, fd, ConnEvent::ERROR, error);
           continue;
         }
-
-        if (fcntl(client_fd, F_SETFL, O_NONBLOCK) < 0) {
-          perror("Set socket nonblock error!");
+        if (events[i].events & EPOLLHUP) {
+          close_connection(io, fd);
           continue;
         }
-
-        ev.data.fd = client_fd;
-        ev.events = EPOLLIN;
-        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
-          perror("Add client epoll event error!");
-          close(client_fd);
-        }
-        std::cout << "Accept conn request from: " << inet_ntoa(client_address.sin_addr)
-          << ":" << client_address.sin_port << std::endl;
-      } else if (events[i].events & EPOLLIN) {
-        // 读数据
-        int fd = events[i].data.fd;
-        if (time_map.find(fd) != time_map.end()) {
-          time_map[fd] = std::time(0);
-        } else {
-          time_map.insert(make_pair(fd, std::time(0)));
-        }
-        if (fd_map.find(fd) == fd_map.end()) {
-          TCPBuffer req{epoll_fd, fd, 0, ""};
-          fd_map.insert(make_pair(fd, req));
-        }
-        TCPBuffer& tcp_buf = fd_map[fd];
-        std::string s = "";
-        int read_count;
-        while (1) {
-          read_count = read(fd, &buf, 1024);
-          if (read_count > 0) {
-            s += std::string(buf, read_count);
-          } else {
-            break;
-          }
+        if (events[i].events & EPOLLIN) {
+          read_connection(io, fd);
         }
-        if (read_count == 0 || read_count == -1 && errno != EAGAIN) {
-          if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev) < 0) {
-            perror("Error delete client listen");
+        if (events[i].events & EPOLLOUT) {
+          auto it = io.fd_map.find(fd);
+          if (it != io.fd_map.end()) {
+            flush(io, it->second);
           }
-          fd_map.erase(fd);
-          time_map.erase(fd);
-          close(fd);
+        }
+      }
+    }
+    std::time_t now = time(0);
+    if (now != last_sweep) {
+      last_sweep = now;
+      for (std::unordered_map<int, time_t>::iterator iter = io.time_map.begin(); iter != io.time_map.end();) {
+        int fd = iter->first;
+        iter++;
+        time_t idle = now - io.time_map[fd];
+        auto conn_it = io.fd_map.find(fd);
+        if (conn_it != io.fd_map.end() && !conn_it->second.event_streams.empty() && idle > SSE_HEARTBEAT_INTERVAL) {
+          // SSE连接空闲时发送心跳，写出后刷新超时时间
+          heartbeat(io, conn_it->second);
           continue;
         }
-        tcp_buf.content += s;
-        // 尝试解析request
-        std::string::size_type position;
-        while (1) {
-          if ((position = tcp_buf.content.find("\r\n\r\n")) != std::string::npos) {
-            HTTPRequest req;
-            req.epoll_fd = epoll_fd;
-            req.fd = fd;
-            std::istringstream s_buf(tcp_buf.content);
-            s_buf >> req.method;
-            s_buf >> req.path;
-            s_buf >> req.protocal;
-            std::string header;
-            std::getline(s_buf, header);
-            while (std::getline(s_buf, header) && header != "\r") {
-              int index = header.find(':', 0);
-              if(index != std::string::npos) {
-                std::string key = boost::algorithm::to_lower_copy(boost::algorithm::trim_copy(header.substr(0, index)));
-                req.headers.insert(make_pair(
-                  key,
-                  boost::algorithm::trim_copy(header.substr(index + 1))
-                ));
-              }
-            }
-            if (req.headers.find("content-length") != req.headers.end()) {
-              tcp_buf.len = stoi(req.headers["content-length"]);
-            }
-            if (tcp_buf.len > 0) {
-              if (tcp_buf.content.length() - position - 4 >= tcp_buf.len) {
-                req.body = tcp_buf.content.substr(position + 4, tcp_buf.len);
-              } else {
-                break;
-              }
-            }
-            // 加入队列
-            queue.enqueue(req);
-            // 更新 tcp buffer
-            tcp_buf.content = tcp_buf.content.substr(position + 4 + tcp_buf.len);
-            tcp_buf.len = 0;
-          } else {
-            break;
+        if (conn_it != io.fd_map.end() && conn_it->second.ws) {
+          // WebSocket以收到对端数据为准，空闲一段时间后先发ping探测
+          idle = now - conn_it->second.ws->last_seen;
+          if (idle > WS_PING_INTERVAL && idle <= MAX_CONNECTION_TIMEOUT && conn_it->second.ws->ping()) {
+            flush(io, conn_it->second);
+            continue;
           }
         }
-      } else if (events[i].events & EPOLLERR) {
-        perror("Error!");
-        close(events[i].data.fd);
+        if (idle > MAX_CONNECTION_TIMEOUT) {
+          close_connection(io, fd, ConnEvent::TIMEOUT);
+        }
       }
     }
-    if (readys == 0) {
-      std::time_t now = time(0);
-      for (std::unordered_map<int, time_t>::iterator iter = time_map.begin(); iter != time_map.end();) {
-        if (now - iter->second > MAX_CONNECTION_TIMEOUT) {
-          if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, iter->first, &ev) < 0) {
-            perror("Error del listen client epoll");
+  }
+}
+
+void pulsation::Server::accept_connection(IOThread& io) {
+  struct sockaddr_in client_address;
+  socklen_t client_len = sizeof(client_address);
+  int client_fd = accept(sockfd, (struct sockaddr *)&client_address, &client_len);
+  if (client_fd < 0) {
+    if (errno != EAGAIN) {
+      perror("Accept socket error!");
+    }
+    return;
+  }
+
+  if (fcntl(client_fd, F_SETFL, O_NONBLOCK) < 0) {
+    perror("Set socket nonblock error!");
+    close(client_fd);
+    return;
+  }
+
+  struct epoll_event ev;
+  ev.data.fd = client_fd;
+  ev.events = EPOLLIN;
+  if (epoll_ctl(io.epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+    perror("Add client epoll event error!");
+    close(client_fd);
+    return;
+  }
+  ConnBuffer& conn_buf = io.fd_map[client_fd];
+  conn_buf.in.epoll_fd = io.epoll_fd;
+  conn_buf.in.fd = client_fd;
+  conn_buf.in.len = 0;
+  conn_buf.conn = std::make_shared<Connection>(client_fd, &io.channel);
+  conn_buf.addr = client_address.sin_addr.s_addr;
+  conn_buf.port = ntohs(client_address.sin_port);
+  io.time_map[client_fd] = std::time(0);
+  if (events) {
+    events->emit(EventLevel::DEBUG, ConnEvent::ACCEPT, client_fd, conn_buf.addr, conn_buf.port);
+  }
+}
+
+void pulsation::Server::read_connection(IOThread& io, int fd) {
+  auto it = io.fd_map.find(fd);
+  if (it == io.fd_map.end()) {
+    return;
+  }
+  ConnBuffer& conn_buf = it->second;
+  TCPBuffer& tcp_buf = conn_buf.in;
+  io.time_map[fd] = std::time(0);
+  char buf[16384];
+  int read_count;
+  int read_error = 0; // 之后的处理可能覆盖errno
+  try {
+    while (1) {
+      read_count = read(fd, buf, sizeof(buf));
+      if (read_count <= 0) {
+        read_error = read_count < 0 ? errno : 0;
+        break;
+      }
+      if (conn_buf.ws) {
+        tcp_buf.content.append(buf, read_count);
+        if (!conn_buf.ws->feed(tcp_buf.content)) {
+          conn_buf.closing = true;
+        }
+        continue;
+      }
+      if (conn_buf.draining) {
+        continue;
+      }
+      tcp_buf.content.append(buf, read_count);
+      if (!conn_buf.h2 && conn_buf.next_seq == 0 && tcp_buf.state == ParseState::HEADER) {
+        // h2c prior knowledge：连接以HTTP/2 preface开头
+        size_t n = std::min<size_t>(tcp_buf.content.size(), H2_PREFACE_SIZE);
+        if (tcp_buf.content.compare(0, n, H2_PREFACE, n) == 0) {
+          if (n < H2_PREFACE_SIZE) {
+            continue;
           }
-          close(iter->first);
-          iter = time_map.erase(iter);
-        } else iter++;
+          start_h2(io, conn_buf);
+        }
+      }
+      // 每次读取后立即解析，body随到随消费，连接缓冲不会随body增长
+      HTTPRequest req;
+      ParseResult result;
+      while (!conn_buf.h2 && (result = parse_request(tcp_buf, req, limits)) != ParseResult::AGAIN) {
+        if (result == ParseResult::HEAD) {
+          tcp_buf.req.seq = conn_buf.next_seq++;
+          check_head(conn_buf);
+          continue;
+        }
+        if (tcp_buf.discard) {
+          tcp_buf.discard = false;
+          continue;
+        }
+        req.epoll_fd = io.epoll_fd;
+        req.fd = fd;
+        req.conn = conn_buf.conn;
+        if (upgrade_h2(io, conn_buf, req)) {
+          break;
+        }
+        auto conn_header = req.headers.find("connection");
+        if (conn_header != req.headers.end() && boost::algorithm::iequals(conn_header->second, "close")) {
+          // 客户端要求关闭，之后的数据不再解析
+          conn_buf.draining = true;
+        }
+        auto upgrade = req.headers.find("upgrade");
+        if (upgrade != req.headers.end() && boost::algorithm::iequals(upgrade->second, "websocket")) {
+          // 由filter决定是否升级，之后的数据等升级完成后按帧解析
+          conn_buf.draining = true;
+          queue.enqueue(std::move(req));
+          break;
+        }
+        // 加入队列
+        queue.enqueue(std::move(req));
+      }
+      if (conn_buf.h2 && !conn_buf.h2->feed(tcp_buf.content)) {
+        // 已发送GOAWAY，写完后关闭
+        conn_buf.draining = true;
+        conn_buf.closing = true;
+      }
+    }
+  } catch (ServerException& e) {
+    // 报文非法或被prefilter拒绝，直接响应错误，写完后关闭连接
+    HTTPResponse response;
+    response.status_code = e.status;
+    response.headers = {{"connection", "close"}, {"server", "pulsation"}};
+    response.body = e.msg;
+    // 请求头解析失败时该请求还没有序号
+    uint64_t seq = tcp_buf.state == ParseState::HEADER ? conn_buf.next_seq++ : tcp_buf.req.seq;
+    reply(conn_buf, seq, make_slice(serialize_head(response, BodyFraming::LENGTH) + response.body), true, true);
+    conn_buf.draining = true;
+    // 不再解析后续数据
+    tcp_buf = TCPBuffer{};
+    tcp_buf.epoll_fd = io.epoll_fd;
+    tcp_buf.fd = fd;
+    flush(io, conn_buf);
+    return;
+  }
+  if (read_count == 0) {
+    close_connection(io, fd);
+    return;
+  }
+  if (read_count == -1 && read_error != EAGAIN) {
+    close_connection(io, fd, ConnEvent::ERROR, read_error);
+    return;
+  }
+  // prefilter的响应、100 Continue或WebSocket控制帧
+  if (!conn_buf.out.empty() || conn_buf.closing) {
+    flush(io, conn_buf);
+  }
+}
+
+void pulsation::Server::check_head(ConnBuffer& conn_buf) {
+  TCPBuffer& tcp_buf = conn_buf.in;
+  HTTPRequest& req = tcp_buf.req;
+  bool expect_continue = false;
+  auto it = req.headers.find("expect");
+  if (it != req.headers.end()) {
+    if (!boost::algorithm::iequals(it->second, "100-continue")) {
+      throw ServerException{"417", "Unsupported expectation"};
+    }
+    // 没有body或HTTP/1.0客户端不需要100 Continue
+    expect_continue = tcp_buf.state != ParseState::COMPLETE && req.protocal == "HTTP/1.1";
+  }
+  for (PreFilterFunc& f_pre : prefilters) {
+    Slice response = f_pre(req);
+    if (response.data) {
+      // 客户端未收到100 Continue时不会发送body，后续数据无法可靠区分，响应后关闭连接
+      reply(conn_buf, req.seq, std::move(response), true, expect_continue);
+      conn_buf.draining = conn_buf.draining || expect_continue;
+      tcp_buf.discard = true;
+      return;
+    }
+  }
+  if (expect_continue) {
+    // 100 Continue属于该请求的临时响应，同样要排在前面请求的响应之后
+    reply(conn_buf, req.seq, make_slice("HTTP/1.1 100 Continue\r\n\r\n"), false, false);
+  }
+}
+
+void pulsation::Server::start_h2(IOThread& io, ConnBuffer& conn_buf) {
+  int fd = conn_buf.in.fd;
+  ConnBuffer* buffer = &conn_buf;
+  conn_buf.h2.reset(new Http2Session(conn_buf.conn, limits.max_body,
+    [this, &io, fd](HTTPRequest&& req) {
+      req.epoll_fd = io.epoll_fd;
+      req.fd = fd;
+      queue.enqueue(std::move(req));
+    },
+    [this](HTTPRequest& req) {
+      for (PreFilterFunc& f_pre : prefilters) {
+        Slice response = f_pre(req);
+        if (response.data) {
+          return response;
+        }
+      }
+      return Slice{};
+    },
+    [buffer](Slice data, bool counted) {
+      if (!counted) {
+        buffer->conn->pending += data.size;
+      }
+      buffer->out.push_back(std::move(data));
+    }));
+  conn_buf.h2->start();
+}
+
+bool pulsation::Server::upgrade_h2(IOThread& io, ConnBuffer& conn_buf, HTTPRequest& req) {
+  auto upgrade = req.headers.find("upgrade");
+  auto settings = req.headers.find("http2-settings");
+  if (upgrade == req.headers.end() || settings == req.headers.end() ||
+      boost::algorithm::ifind_first(upgrade->second, "h2c").empty()) {
+    return false;
+  }
+  // 带body或前面还有未完成的响应时不升级，按HTTP/1.1处理
+  if (!req.body.empty() || req.body_file || req.seq != conn_buf.write_seq || req.protocal != "HTTP/1.1") {
+    return false;
+  }
+  reply(conn_buf, req.seq, make_slice("HTTP/1.1 101 Switching Protocols\r\nconnection: Upgrade\r\nupgrade: h2c\r\n\r\n"), true, false);
+  start_h2(io, conn_buf);
+  std::string value = settings->second;
+  if (!conn_buf.h2->upgrade(std::move(req), value)) {
+    conn_buf.draining = true;
+    conn_buf.closing = true;
+  }
+  return true;
+}
+
+void pulsation::Server::accept_websocket(ConnBuffer& conn_buf, Message& msg) {
+  // 101响应之后的帧都使用下一个序号，保证写在101之后
+  uint64_t seq = msg.seq + 1;
+  deliver(conn_buf, msg.seq, std::move(msg.data), true, false);
+  WebSocketPtr handle = std::move(conn_buf.conn->websocket);
+  if (!handle) {
+    return;
+  }
+  ConnBuffer* buffer = &conn_buf;
+  conn_buf.ws.reset(new WebSocketSession(WS_MAX_MESSAGE_SIZE,
+    [this, buffer, seq](Slice data, bool counted, bool close) {
+      if (!counted) {
+        buffer->conn->pending += data.size;
+      }
+      deliver(*buffer, seq, std::move(data), false, close);
+    },
+    [this, handle](WebSocketEvent&& event) {
+      if (handle->post(std::move(event))) {
+        ws_queue.enqueue(handle);
+      }
+    }));
+  conn_buf.draining = false;
+  conn_buf.ws->open();
+  // 升级请求之后已到达的数据
+  if (!conn_buf.in.content.empty() && !conn_buf.ws->feed(conn_buf.in.content)) {
+    conn_buf.closing = true;
+  }
+}
+
+void pulsation::Server::open_event_stream(ConnBuffer& conn_buf, Message& msg) {
+  std::shared_ptr<EventTopic> topic;
+  {
+    std::lock_guard<std::mutex> lock(conn_buf.conn->mutex);
+    auto& subscriptions = conn_buf.conn->subscriptions;
+    for (auto it = subscriptions.begin(); it != subscriptions.end(); ++it) {
+      if (it->first == msg.seq) {
+        topic = std::move(it->second);
+        subscriptions.erase(it);
+        break;
       }
     }
   }
+  if (topic) {
+    topic->subscribe(conn_buf.conn, msg.seq, conn_buf.h2 != nullptr);
+    conn_buf.event_streams.emplace_back(msg.seq, std::move(topic));
+  }
+}
+
+void pulsation::Server::heartbeat(IOThread& io, ConnBuffer& conn_buf) {
+  const EncodedEvent& ping = sse_heartbeat();
+  for (auto& item : conn_buf.event_streams) {
+    if (conn_buf.h2) {
+      // 流已被重置时会被丢弃
+      Message msg{conn_buf.conn, item.first, ping.payload, false, false, MSG_H2_DATA};
+      conn_buf.conn->pending += ping.payload.size;
+      conn_buf.h2->on_message(msg);
+    } else {
+      reply(conn_buf, item.first, ping.chunked, false, false);
+    }
+  }
+  flush(io, conn_buf);
+}
+
+void pulsation::Server::drain_channel(IOThread& io) {
+  io.channel.reset();
+  Message msgs[64];
+  std::vector<int> dirty;
+  size_t count;
+  while ((count = io.channel.queue.try_dequeue_bulk(msgs, 64)) > 0) {
+    for (size_t i = 0; i < count; ++i) {
+      Message& msg = msgs[i];
+      auto it = io.fd_map.find(msg.conn->fd);
+      if (it == io.fd_map.end() || it->second.conn != msg.conn) {
+        // 连接已关闭（fd可能已被复用），丢弃
+        msg.conn->consumed(msg.data.size);
+        if (msg.type == MSG_WS_ACCEPT) {
+          // 升级没有完成，释放worker设置的WebSocket，其handler可能持有连接而形成循环引用
+          msg.conn->websocket.reset();
+        }
+        msg = Message{};
+        continue;
+      }
+      if (msg.type == MSG_WS_ACCEPT) {
+        accept_websocket(it->second, msg);
+      } else if (msg.type == MSG_SSE_OPEN) {
+        open_event_stream(it->second, msg);
+      } else if (it->second.ws) {
+        it->second.ws->on_message(msg);
+      } else if (it->second.h2) {
+        it->second.h2->on_message(msg);
+      } else {
+        deliver(it->second, msg.seq, std::move(msg.data), msg.last, msg.close);
+      }
+      dirty.push_back(msg.conn->fd);
+      msg = Message{};
+    }
+  }
+  for (int fd : dirty) {
+    auto it = io.fd_map.find(fd);
+    if (it != io.fd_map.end()) {
+      flush(io, it->second);
+    }
+  }
+}
+
+void pulsation::Server::deliver(ConnBuffer& conn_buf, uint64_t seq, Slice data, bool last, bool close) {
+  if (seq != conn_buf.write_seq) {
+    // 前面的请求还没响应完，先暂存；暂存的数据要等前面的响应写完才能发出，
+    // 不计入连接的背压，否则前面流式响应的write会因它们而阻塞，互相等待
+    PendingResponse& pending = conn_buf.reorder[seq];
+    if (data.size > 0) {
+      conn_buf.conn->consumed(data.size);
+      pending.slices.push_back(std::move(data));
+    }
+    pending.last = pending.last || last;
+    pending.close = pending.close || close;
+    return;
+  }
+  if (data.size > 0) {
+    conn_buf.out.push_back(std::move(data));
+  }
+  conn_buf.closing = conn_buf.closing || close;
+  if (!last) {
+    return;
+  }
+  // 当前响应已完整，依次放出后续已到达的响应
+  conn_buf.write_seq++;
+  auto it = conn_buf.reorder.begin();
+  while (it != conn_buf.reorder.end() && it->first == conn_buf.write_seq) {
+    PendingResponse& pending = it->second;
+    for (Slice& slice : pending.slices) {
+      conn_buf.conn->pending += slice.size;
+      conn_buf.out.push_back(std::move(slice));
+    }
+    conn_buf.closing = conn_buf.closing || pending.close;
+    if (!pending.last) {
+      // 仍在流式发送，之后的数据直接写出
+      conn_buf.reorder.erase(it);
+      return;
+    }
+    conn_buf.write_seq++;
+    it = conn_buf.reorder.erase(it);
+  }
+}
+
+void pulsation::Server::reply(ConnBuffer& conn_buf, uint64_t seq, Slice data, bool last, bool close) {
+  conn_buf.conn->pending += data.size;
+  deliver(conn_buf, seq, std::move(data), last, close);
+}
+
+void pulsation::Server::flush(IOThread& io, ConnBuffer& conn_buf) {
+  int fd = conn_buf.in.fd;
+  while (!conn_buf.out.empty()) {
+    struct iovec iov[MAX_WRITE_IOV];
+    int iov_count = 0;
+    for (auto it = conn_buf.out.begin(); it != conn_buf.out.end() && iov_count < MAX_WRITE_IOV; ++it) {
+      size_t offset = iov_count == 0 ? conn_buf.out_offset : 0;
+      iov[iov_count].iov_base = const_cast<char*>(it->data + offset);
+      iov[iov_count].iov_len = it->size - offset;
+      iov_count++;
+    }
+    ssize_t written = writev(fd, iov, iov_count);
+    if (written < 0) {
+      if (errno == EAGAIN) {
+        break;
+      }
+      close_connection(io, fd, ConnEvent::ERROR, errno);
+      return;
+    }
+    conn_buf.conn->consumed(written);
+    size_t left = written;
+    while (left > 0) {
+      Slice& front = conn_buf.out.front();
+      size_t remain = front.size - conn_buf.out_offset;
+      if (left >= remain) {
+        left -= remain;
+        conn_buf.out.pop_front();
+        conn_buf.out_offset = 0;
+      } else {
+        conn_buf.out_offset += left;
+        left = 0;
+      }
+    }
+    io.time_map[fd] = std::time(0);
+  }
+  if (conn_buf.out.empty() && conn_buf.closing) {
+    close_connection(io, fd);
+    return;
+  }
+  // 写不完时监听EPOLLOUT，写完后取消
+  bool want_write = !conn_buf.out.empty();
+  if (want_write != conn_buf.want_write) {
+    struct epoll_event ev;
+    ev.data.fd = fd;
+    ev.events = want_write ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    if (epoll_ctl(io.epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+      perror("Error modify client epoll");
+    }
+    conn_buf.want_write = want_write;
+  }
+}
+
+void pulsation::Server::close_connection(IOThread& io, int fd, ConnEvent reason, int error) {
+  struct epoll_event ev;
+  if (epoll_ctl(io.epoll_fd, EPOLL_CTL_DEL, fd, &ev) < 0) {
+    perror("Error delete client listen");
+  }
+  auto it = io.fd_map.find(fd);
+  if (it != io.fd_map.end()) {
+    ConnBuffer& conn_buf = it->second;
+    if (events) {
+      EventLevel level = reason == ConnEvent::ERROR ? EventLevel::WARN : reason == ConnEvent::TIMEOUT ? EventLevel::INFO : EventLevel::DEBUG;
+      events->emit(level, reason, fd, conn_buf.addr, conn_buf.port, error);
+    }
+    size_t dropped = 0;
+    for (Slice& slice : conn_buf.out) {
+      dropped += slice.size;
+    }
+    dropped -= conn_buf.out_offset;
+    if (conn_buf.h2) {
+      dropped += conn_buf.h2->buffered();
+    }
+    if (conn_buf.ws) {
+      conn_buf.ws->closed();
+    }
+    for (auto& item : conn_buf.event_streams) {
+      item.second->unsubscribe(conn_buf.conn.get(), item.first);
+    }
+    conn_buf.conn->consumed(dropped);
+    conn_buf.conn->mark_closed();
+    io.fd_map.erase(it);
+  }
+  io.time_map.erase(fd);
+  close(fd);
 }
 
 void pulsation::Server::run() {
   for (int i = 0; i < threads; ++i) {
-    std::thread io_thread([this]{
-      process();
+    IOThread* io = new IOThread();
+    io->channel.event_fd = eventfd(0, EFD_NONBLOCK);
+    if (io->channel.event_fd < 0) {
+      perror("Error create eventfd");
+      exit(1);
+    }
+    io_threads.push_back(io);
+    std::thread io_thread([this, io]{
+      process(*io);
     });
     io_thread.detach();
   }
   auto worker_func = std::mem_fn(&pulsation::Worker::process);
   for (int i = 0; i < work_threads; ++i) {
-    pulsation::Worker* worker = new pulsation::Worker(&queue, &filters);
+    pulsation::Worker* worker = new pulsation::Worker(&queue, &ws_queue, &filters);
     workers.push_back(worker);
     std::thread worker_thread(worker_func, worker);
     worker_thread.detach();
@@ -247,6 +667,23 @@ pulsation::Server& pulsation::Server::use(InitFunc f_init, CallbackFunc f_callba
   return *this;
 }
 
+pulsation::Server& pulsation::Server::prefilter(PreFilterFunc f_pre) {
+  prefilters.push_back(f_pre);
+  return *this;
+}
+
+pulsation::Server& pulsation::Server::spool(size_t threshold, size_t max_size, string dir) {
+  limits.spool_threshold = threshold;
+  limits.max_spool_body = max_size;
+  limits.spool_dir = dir;
+  return *this;
+}
+
+pulsation::Server& pulsation::Server::event_log(EventLevel level, string path) {
+  events.reset(level == EventLevel::OFF ? nullptr : new EventLog(level, path));
+  return *this;
+}
+
 pulsation::Server& pulsation::Server::use(CallbackFunc f_callback) {
   Filter filter{f_callback};
   filters.push_back(filter);
@@ -1,16 +1,54 @@
 #include <mutex>
 #include <cstring>
 #include <vector>
+#include <deque>
+#include <map>
+#include <ctime>
 #include "concurrentqueue.h"
 #include "http.h"
 #include "worker.h"
 #include "filter.h"
+#include "parser.h"
+#include "http2.h"
+#include "event_log.h"
 
 namespace pulsation {
   #define MAX_EVENTS 1024
   #define EVENT_WAIT_TIMEOUT 100
   #define MAX_QUEUE_CAPACITY 2048
   #define MAX_CONNECTION_TIMEOUT 60
+  #define MAX_WRITE_IOV 64
+  // 尚不能写出的流水线响应
+  struct PendingResponse {
+    std::vector<Slice> slices;
+    bool last = false;
+    bool close = false;
+  };
+  // IO线程中每个连接的读写缓冲
+  struct ConnBuffer {
+    TCPBuffer in;
+    std::shared_ptr<Connection> conn;
+    std::deque<Slice> out;
+    size_t out_offset = 0; // out首个片段已写出的字节数
+    bool closing = false;  // 发送队列写完后关闭
+    bool draining = false; // 不再解析新的请求
+    bool want_write = false; // 是否已监听EPOLLOUT
+    uint64_t next_seq = 0;   // 下一个请求的序号
+    uint64_t write_seq = 0;  // 当前可以写出的响应序号
+    std::map<uint64_t, PendingResponse> reorder; // 先于前面请求完成的响应暂存于此
+    std::unique_ptr<Http2Session> h2; // 切换到HTTP/2后的会话
+    std::unique_ptr<WebSocketSession> ws; // 切换到WebSocket后的会话
+    std::vector<std::pair<uint64_t, std::shared_ptr<EventTopic>>> event_streams; // 已生效的SSE订阅
+    uint32_t addr = 0; // 对端地址，仅用于事件日志
+    uint16_t port = 0;
+  };
+  // 每个IO线程独占的状态，只有channel会被worker线程访问
+  struct IOThread {
+    int epoll_fd;
+    Channel channel;
+    std::unordered_map<int, ConnBuffer> fd_map;
+    std::unordered_map<int, time_t> time_map;
+  };
   class Server {
   private:
     unsigned int port;
@@ -19,14 +57,39 @@ namespace pulsation {
     int sockfd;
     std::mutex mutex;
     moodycamel::ConcurrentQueue<HTTPRequest> queue;
+    moodycamel::ConcurrentQueue<WebSocketPtr> ws_queue;
     vector<Worker*> workers;
     vector<Filter> filters;
+    vector<IOThread*> io_threads;
+    ParserLimits limits;
+    vector<PreFilterFunc> prefilters;
+    std::unique_ptr<EventLog> events; // 为空时不记录连接事件
+    void accept_connection(IOThread& io);
+    void read_connection(IOThread& io, int fd);
+    void check_head(ConnBuffer& conn_buf);
+    void start_h2(IOThread& io, ConnBuffer& conn_buf);
+    bool upgrade_h2(IOThread& io, ConnBuffer& conn_buf, HTTPRequest& req);
+    void accept_websocket(ConnBuffer& conn_buf, Message& msg);
+    void open_event_stream(ConnBuffer& conn_buf, Message& msg);
+    void heartbeat(IOThread& io, ConnBuffer& conn_buf);
+    void drain_channel(IOThread& io);
+    void deliver(ConnBuffer& conn_buf, uint64_t seq, Slice data, bool last, bool close);
+    // IO线程自身产生的响应（错误、100 Continue、prefilter），同样按序号写出
+    void reply(ConnBuffer& conn_buf, uint64_t seq, Slice data, bool last, bool close);
+    void flush(IOThread& io, ConnBuffer& conn_buf);
+    // reason与error只用于事件日志
+    void close_connection(IOThread& io, int fd, ConnEvent reason = ConnEvent::CLOSE, int error = 0);
   public:
     Server(unsigned int port, int work_threads);
     ~Server();
     void run();
-    void process();
+    void process(IOThread& io);
     Server& use(InitFunc f_init, CallbackFunc f_callback);
     Server& use(CallbackFunc f_callback);
+    Server& prefilter(PreFilterFunc f_pre);
+    // 超过threshold字节的请求体边接收边写入dir下的临时文件，内存占用与body大小无关
+    Server& spool(size_t threshold, size_t max_size = MAX_SPOOL_BODY_SIZE, string dir = "/tmp");
+    // 记录不低于level的连接事件（建立、关闭、超时、出错），path为空时输出到stderr
+    Server& event_log(EventLevel level, string path = "");
   };
 }
\ No newline at end of file
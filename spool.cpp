@@ -0,0 +1,62 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cerrno>
+#include <algorithm>
+#include "spool.h"
+
+pulsation::BodyFile::BodyFile(int fd): fd(fd), length(0) {}
+
+pulsation::BodyFile::~BodyFile() {
+  close(fd);
+}
+
+shared_ptr<pulsation::BodyFile> pulsation::BodyFile::create(const string& dir) {
+  int fd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    fd = memfd_create("pulsation-body", MFD_CLOEXEC);
+  }
+  if (fd < 0) {
+    perror("Error create body spool file");
+    throw ServerException{"500", "Can not spool request body"};
+  }
+  return make_shared<BodyFile>(fd);
+}
+
+void pulsation::BodyFile::append(const char* data, size_t n) {
+  while (n > 0) {
+    ssize_t written = pwrite(fd, data, n, length);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      perror("Error write body spool file");
+      throw ServerException{"500", "Can not spool request body"};
+    }
+    data += written;
+    n -= written;
+    length += written;
+  }
+}
+
+size_t pulsation::BodyFile::read(size_t offset, char* buf, size_t n) const {
+  if (offset >= length) {
+    return 0;
+  }
+  ssize_t count = pread(fd, buf, std::min(n, length - offset), offset);
+  return count < 0 ? 0 : count;
+}
+
+size_t pulsation::BodyStream::read(char* buf, size_t n) {
+  size_t count;
+  if (req.body_file) {
+    count = req.body_file->read(offset, buf, n);
+  } else {
+    count = std::min(n, req.body.size() - offset);
+    memcpy(buf, req.body.data() + offset, count);
+  }
+  offset += count;
+  return count;
+}
+
+size_t pulsation::BodyStream::size() const {
+  return req.body_file ? req.body_file->size() : req.body.size();
+}
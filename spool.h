@@ -0,0 +1,36 @@
+#pragma once
+#include <memory>
+#include <string>
+#include "http.h"
+
+namespace pulsation {
+  #define MAX_SPOOL_BODY_SIZE (1024L * 1024 * 1024)
+  // 落盘的请求体，优先使用目录下的匿名临时文件(O_TMPFILE)，不支持时退回memfd
+  class BodyFile {
+    private:
+      int fd;
+      size_t length;
+    public:
+      BodyFile(int fd);
+      ~BodyFile();
+      BodyFile(const BodyFile&) = delete;
+      BodyFile& operator=(const BodyFile&) = delete;
+      // 创建失败时抛出ServerException
+      static shared_ptr<BodyFile> create(const string& dir);
+      void append(const char* data, size_t n);
+      size_t read(size_t offset, char* buf, size_t n) const;
+      size_t size() const { return length; }
+      int file() const { return fd; }
+  };
+  // 顺序读取请求体，body在内存中或已落盘对handler透明
+  class BodyStream {
+    private:
+      const HTTPRequest& req;
+      size_t offset = 0;
+    public:
+      BodyStream(const HTTPRequest& req): req(req) {}
+      // 返回0表示读完
+      size_t read(char* buf, size_t n);
+      size_t size() const;
+  };
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+namespace pulsation {
+  // 单生产者单消费者环形队列，Size必须是2的幂
+  template<typename T, size_t Size>
+  class SpscRing {
+    static_assert((Size & (Size - 1)) == 0, "ring size must be a power of two");
+    private:
+      alignas(64) std::atomic<size_t> head{0}; // 生产者写入位置
+      alignas(64) std::atomic<size_t> tail{0}; // 消费者读取位置
+      alignas(64) T records[Size];
+    public:
+      // 队列满时返回false
+      bool push(const T& record) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= Size) {
+          return false;
+        }
+        records[h & (Size - 1)] = record;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+      }
+      // 取出最多max条记录，返回实际条数
+      size_t pop(T* out, size_t max) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t n = std::min(head.load(std::memory_order_acquire) - t, max);
+        for (size_t i = 0; i < n; ++i) {
+          out[i] = records[(t + i) & (Size - 1)];
+        }
+        tail.store(t + n, std::memory_order_release);
+        return n;
+      }
+  };
+}
@@ -0,0 +1,95 @@
+#include <sstream>
+#include <unordered_map>
+#include "sse.h"
+
+namespace {
+  pulsation::EncodedEvent frame_event(const std::string& payload) {
+    std::ostringstream s_chunk;
+    s_chunk << std::hex << payload.size() << "\r\n";
+    size_t prefix = s_chunk.str().size();
+    s_chunk << payload << "\r\n";
+    pulsation::Slice chunked = pulsation::make_slice(s_chunk.str());
+    return pulsation::EncodedEvent{chunked, pulsation::Slice{chunked.owner, chunked.data + prefix, payload.size()}};
+  }
+}
+
+pulsation::EncodedEvent pulsation::encode_event(const std::string& data, const std::string& event, const std::string& id) {
+  std::string payload;
+  if (!event.empty()) {
+    payload += "event: " + event + "\n";
+  }
+  if (!id.empty()) {
+    payload += "id: " + id + "\n";
+  }
+  size_t start = 0;
+  while (1) {
+    size_t end = data.find('\n', start);
+    payload += "data: ";
+    payload.append(data, start, end == std::string::npos ? std::string::npos : end - start);
+    payload += "\n";
+    if (end == std::string::npos) {
+      break;
+    }
+    start = end + 1;
+  }
+  payload += "\n";
+  return frame_event(payload);
+}
+
+const pulsation::EncodedEvent& pulsation::sse_heartbeat() {
+  static const EncodedEvent heartbeat = frame_event(": ping\n\n");
+  return heartbeat;
+}
+
+size_t pulsation::EventTopic::publish(const std::string& data, const std::string& event, const std::string& id) {
+  return publish(encode_event(data, event, id));
+}
+
+size_t pulsation::EventTopic::publish(const EncodedEvent& encoded) {
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t count = 0;
+  for (Subscriber& sub : subscribers) {
+    if (sub.conn->closed.load() || sub.conn->pending.load() >= HIGH_WATER_MARK) {
+      continue;
+    }
+    if (sub.h2) {
+      sub.conn->send(sub.seq, encoded.payload, false, false, MSG_H2_DATA);
+    } else {
+      sub.conn->send(sub.seq, encoded.chunked, false);
+    }
+    count++;
+  }
+  return count;
+}
+
+void pulsation::EventTopic::subscribe(const std::shared_ptr<Connection>& conn, uint64_t seq, bool h2) {
+  std::lock_guard<std::mutex> lock(mutex);
+  subscribers.push_back(Subscriber{conn, seq, h2});
+}
+
+void pulsation::EventTopic::unsubscribe(const Connection* conn, uint64_t seq) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto it = subscribers.begin(); it != subscribers.end(); ++it) {
+    if (it->conn.get() == conn && it->seq == seq) {
+      *it = std::move(subscribers.back());
+      subscribers.pop_back();
+      return;
+    }
+  }
+}
+
+size_t pulsation::EventTopic::size() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return subscribers.size();
+}
+
+std::shared_ptr<pulsation::EventTopic> pulsation::event_topic(const std::string& name) {
+  static std::mutex mutex;
+  static std::unordered_map<std::string, std::shared_ptr<EventTopic>> topics;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::shared_ptr<EventTopic>& topic = topics[name];
+  if (!topic) {
+    topic = std::make_shared<EventTopic>();
+  }
+  return topic;
+}
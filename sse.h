@@ -0,0 +1,43 @@
+#pragma once
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include "connection.h"
+
+namespace pulsation {
+  #define SSE_HEARTBEAT_INTERVAL 15
+  // 一条编码好的事件，HTTP/1.1的chunk与HTTP/2的DATA共用同一块内存
+  struct EncodedEvent {
+    Slice chunked; // 带chunk长度行的完整chunk
+    Slice payload; // 仅事件本身，是chunked的一部分
+  };
+  // 按SSE格式编码，多行data拆成多个data字段
+  EncodedEvent encode_event(const std::string& data, const std::string& event = "", const std::string& id = "");
+  // 心跳注释，保持空闲的事件流不被中间代理断开
+  const EncodedEvent& sse_heartbeat();
+
+  /**
+   * SSE主题。订阅由IO线程在响应头写出后登记，
+   * publish只编码一次，同一份数据挂到所有订阅连接的发送队列上。
+   **/
+  class EventTopic {
+    private:
+      struct Subscriber {
+        std::shared_ptr<Connection> conn;
+        uint64_t seq;
+        bool h2;
+      };
+      std::mutex mutex;
+      std::vector<Subscriber> subscribers;
+    public:
+      // 返回实际发送的订阅数，积压超过高水位的连接跳过本条事件
+      size_t publish(const std::string& data, const std::string& event = "", const std::string& id = "");
+      size_t publish(const EncodedEvent& encoded);
+      void subscribe(const std::shared_ptr<Connection>& conn, uint64_t seq, bool h2);
+      void unsubscribe(const Connection* conn, uint64_t seq);
+      size_t size();
+  };
+  // 进程内按名字共享的主题，不存在时创建
+  std::shared_ptr<EventTopic> event_topic(const std::string& name);
+}
@@ -0,0 +1,488 @@
+#include <cstdio>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <csetjmp>
+#include <csignal>
+#include <mutex>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "static_cache.h"
+#include "compress.h"
+#include "xxhash.h"
+#include "clock.h"
+#include "http.h"
+
+#define STATIC_CACHE_WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | \
+  IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+#define STATIC_CACHE_POLL_MS 200 // 监听线程检查退出标志的间隔
+
+namespace {
+  const pulsation::Encoding sidecar_encodings[] = {pulsation::Encoding::ZSTD, pulsation::Encoding::BR, pulsation::Encoding::GZIP};
+
+  /**
+   * 按段规范化请求路径，去掉空段与"."，处理".."，结果形如"/a/b"。
+   * 越过根目录、以"/"结尾或为根目录本身时返回false，这些路径不会是文件
+   **/
+  bool normalize_path(std::string_view path, std::string& key) {
+    if (path.empty() || path[0] != '/' || path.back() == '/') {
+      return false;
+    }
+    size_t pos = 0;
+    while (pos < path.size()) {
+      size_t end = path.find('/', pos);
+      if (end == std::string_view::npos) end = path.size();
+      std::string_view segment = path.substr(pos, end - pos);
+      pos = end + 1;
+      if (segment.empty() || segment == ".") {
+        continue;
+      }
+      if (segment == "..") {
+        size_t slash = key.rfind('/');
+        if (slash == std::string::npos) {
+          return false;
+        }
+        key.resize(slash);
+        continue;
+      }
+      key += '/';
+      key.append(segment.data(), segment.size());
+    }
+    return !key.empty() && key.find('\0') == std::string::npos;
+  }
+
+  // 读取普通文件：较大的文件建立只读共享映射，其余读入内存
+  bool load_regular_file(const std::string& path, struct stat& st, pulsation::Slice& out, bool& mapped) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return false;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+      close(fd);
+      return false;
+    }
+    if (st.st_size >= STATIC_MMAP_MIN_SIZE) {
+      size_t size = st.st_size;
+      void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      // 映射建立后不再需要fd
+      close(fd);
+      if (addr == MAP_FAILED) {
+        return false;
+      }
+      std::shared_ptr<const void> owner(addr, [size](const void* p) {
+        munmap(const_cast<void*>(p), size);
+      });
+      out = pulsation::Slice{owner, static_cast<const char*>(addr), size};
+      mapped = true;
+      return true;
+    }
+    std::string content(st.st_size, '\0');
+    size_t used = 0;
+    while (1) {
+      if (used == content.size()) {
+        // 读取期间文件变长
+        content.resize(content.size() + 4096);
+      }
+      ssize_t n = read(fd, &content[used], content.size() - used);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        close(fd);
+        return false;
+      }
+      if (n == 0) {
+        break;
+      }
+      used += n;
+    }
+    close(fd);
+    content.resize(used);
+    out = pulsation::make_slice(std::move(content));
+    return true;
+  }
+
+  // 正在执行copy_mapped的线程的跳转点
+  thread_local sigjmp_buf* sigbus_jump = nullptr;
+  struct sigaction previous_sigbus;
+
+  void on_sigbus(int, siginfo_t*, void*) {
+    if (sigbus_jump != nullptr) {
+      siglongjmp(*sigbus_jump, 1);
+    }
+    // 不是拷贝映射时产生的，恢复原来的处理方式，返回后重新执行出错的指令
+    sigaction(SIGBUS, &previous_sigbus, nullptr);
+  }
+
+  bool ends_with(std::string_view s, std::string_view suffix) {
+    return s.size() > suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+  }
+
+  // 按纳秒比较修改时间，同一秒内修改过的原文件不会误用旧的旁路文件
+  bool not_older(const struct stat& a, const struct stat& b) {
+    return a.st_mtim.tv_sec != b.st_mtim.tv_sec ? a.st_mtim.tv_sec > b.st_mtim.tv_sec : a.st_mtim.tv_nsec >= b.st_mtim.tv_nsec;
+  }
+}
+
+bool pulsation::copy_mapped(const Slice& data, std::string& out) {
+  static std::once_flag installed;
+  std::call_once(installed, [] {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_sigbus;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, &previous_sigbus);
+  });
+  // 分配在跳转点之前完成，跳转时只跳过memcpy，没有需要析构的对象
+  out.resize(data.size);
+  sigjmp_buf jump;
+  if (sigsetjmp(jump, 1) != 0) {
+    sigbus_jump = nullptr;
+    out.clear();
+    return false;
+  }
+  sigbus_jump = &jump;
+  memcpy(&out[0], data.data, data.size);
+  sigbus_jump = nullptr;
+  return true;
+}
+
+bool pulsation::etag_match(std::string_view if_none_match, std::string_view etag) {
+  // 弱比较，W/前缀不影响结果
+  if (etag.compare(0, 2, "W/") == 0) {
+    etag.remove_prefix(2);
+  }
+  size_t pos = 0;
+  while (pos < if_none_match.size()) {
+    size_t end = if_none_match.find(',', pos);
+    if (end == std::string_view::npos) end = if_none_match.size();
+    std::string_view tag = if_none_match.substr(pos, end - pos);
+    pos = end + 1;
+    size_t first = tag.find_first_not_of(" \t");
+    if (first == std::string_view::npos) {
+      continue;
+    }
+    tag = tag.substr(first, tag.find_last_not_of(" \t") - first + 1);
+    if (tag == "*") {
+      return true;
+    }
+    if (tag.compare(0, 2, "W/") == 0) {
+      tag.remove_prefix(2);
+    }
+    if (tag == etag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+pulsation::StaticCache::StaticCache(const std::string& dir, size_t max_bytes): dir(dir), shard_capacity(max_bytes / STATIC_CACHE_SHARDS) {
+  char real[PATH_MAX];
+  if (realpath(dir.c_str(), real) != nullptr) {
+    root = real;
+  }
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0) {
+    perror("Error init inotify, static file cache disabled");
+    return;
+  }
+  if (root.empty() || !watch_tree("")) {
+    perror("Error watch static dir, static file cache disabled");
+    close(inotify_fd);
+    inotify_fd = -1;
+    watches.clear();
+    return;
+  }
+  watching.store(true);
+  watcher = std::thread([this] { run(); });
+}
+
+pulsation::StaticCache::~StaticCache() {
+  stopping.store(true);
+  if (watcher.joinable()) {
+    watcher.join();
+  }
+  if (inotify_fd >= 0) {
+    close(inotify_fd);
+  }
+}
+
+pulsation::StaticCache::Shard& pulsation::StaticCache::shard_of(std::string_view key) {
+  return shards[xxhash64(key.data(), key.size()) % STATIC_CACHE_SHARDS];
+}
+
+std::shared_ptr<const pulsation::StaticFile> pulsation::StaticCache::get(std::string_view path) {
+  std::string key;
+  if (!normalize_path(path, key)) {
+    return nullptr;
+  }
+  Shard& shard = shard_of(key);
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+      it->second->last_used = Clock::now();
+      hit_count++;
+      return it->second->file;
+    }
+    generation = shard.generation;
+  }
+  miss_count++;
+  // 读盘在锁外进行，并发的相同请求可能各自读一次
+  std::shared_ptr<const StaticFile> file = load(key);
+  if (watching.load()) {
+    insert(shard, generation, key, file);
+  }
+  return file;
+}
+
+std::shared_ptr<const pulsation::StaticFile> pulsation::StaticCache::load(const std::string& key) {
+  if (root.empty()) {
+    return nullptr;
+  }
+  std::string path = dir + key;
+  // 与原先的check_resource_valid一样，真实路径必须在静态目录内
+  char real[PATH_MAX];
+  if (realpath(path.c_str(), real) == nullptr) {
+    return nullptr;
+  }
+  std::string_view real_path(real);
+  if (real_path.size() <= root.size() || real_path.compare(0, root.size(), root) != 0 || real_path[root.size()] != '/') {
+    return nullptr;
+  }
+  auto file = std::make_shared<StaticFile>();
+  struct stat st;
+  bool mapped = false;
+  if (!load_regular_file(path, st, file->body, mapped)) {
+    return nullptr;
+  }
+  if (mapped) {
+    file->mappings++;
+    file->mapped_bytes += file->body.size;
+  }
+  file->size = file->body.size;
+  file->mtime = st.st_mtime;
+  char etag[64];
+  snprintf(etag, sizeof(etag), "\"%llx-%llx\"", static_cast<unsigned long long>(st.st_mtime), static_cast<unsigned long long>(file->size));
+  file->etag = etag;
+  file->type = "text/plain";
+  size_t dot = key.rfind('.');
+  if (dot != std::string::npos && dot > key.rfind('/')) {
+    auto type_it = ext_type.find(key.substr(dot));
+    if (type_it != ext_type.end()) {
+      file->type = type_it->second;
+    }
+  }
+  // 不旧于原文件的预压缩旁路文件（由pulsation-precompress生成）
+  for (Encoding encoding : sidecar_encodings) {
+    struct stat sidecar;
+    bool mapped = false;
+    Slice& out = file->encoded[static_cast<int>(encoding)];
+    if (load_regular_file(path + encoding_suffix(encoding), sidecar, out, mapped) && not_older(sidecar, st)) {
+      file->encodings |= encoding_bit(encoding);
+      if (mapped) {
+        file->mappings++;
+        file->mapped_bytes += out.size;
+      }
+    } else {
+      out = Slice{nullptr, nullptr, 0};
+    }
+  }
+  return file;
+}
+
+void pulsation::StaticCache::erase(Shard& shard, std::list<Entry>::iterator it) {
+  shard.bytes -= it->bytes;
+  if (it->file) {
+    shard.mappings -= it->file->mappings;
+  }
+  shard.index.erase(it->key);
+  shard.entries.erase(it);
+}
+
+void pulsation::StaticCache::insert(Shard& shard, uint64_t generation, const std::string& key, const std::shared_ptr<const StaticFile>& file) {
+  // 映射不占用堆内存，大文件同样缓存，避免每次请求重新打开并映射
+  size_t bytes = key.size() + STATIC_CACHE_ENTRY_OVERHEAD;
+  size_t mappings = 0;
+  if (file) {
+    bytes += file->body.size;
+    for (const Slice& encoded : file->encoded) {
+      bytes += encoded.size;
+    }
+    bytes -= file->mapped_bytes;
+    mappings = file->mappings;
+  }
+  size_t max_mappings = STATIC_CACHE_MAX_MAPPINGS / STATIC_CACHE_SHARDS;
+  if (bytes > shard_capacity || mappings > max_mappings) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  // 读盘期间有过失效，读到的可能是旧内容
+  if (shard.generation != generation) {
+    return;
+  }
+  auto it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    erase(shard, it->second);
+  }
+  while (!shard.entries.empty() && (shard.bytes + bytes > shard_capacity || shard.mappings + mappings > max_mappings)) {
+    erase(shard, std::prev(shard.entries.end()));
+    eviction_count++;
+  }
+  shard.entries.push_front(Entry{key, file, bytes, Clock::now()});
+  shard.index.emplace(shard.entries.front().key, shard.entries.begin());
+  shard.bytes += bytes;
+  shard.mappings += mappings;
+}
+
+void pulsation::StaticCache::invalidate(std::string_view key) {
+  Shard& shard = shard_of(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  shard.generation++;
+  auto it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    erase(shard, it->second);
+    invalidation_count++;
+  }
+}
+
+void pulsation::StaticCache::clear() {
+  for (Shard& shard : shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.generation++;
+    invalidation_count += shard.index.size();
+    shard.index.clear();
+    shard.entries.clear();
+    shard.bytes = 0;
+    shard.mappings = 0;
+  }
+}
+
+void pulsation::StaticCache::evict_idle(time_t now) {
+  for (Shard& shard : shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // 从最久未使用的一端开始，遇到未过期的条目即停止
+    auto it = shard.entries.end();
+    while (it != shard.entries.begin()) {
+      --it;
+      if (it->last_used + STATIC_MMAP_IDLE_SECONDS > now) {
+        break;
+      }
+      // 只移除映射，读入内存的小文件留给LRU淘汰
+      if (it->file && it->file->mappings > 0) {
+        auto next = std::next(it);
+        erase(shard, it);
+        it = next;
+        eviction_count++;
+      }
+    }
+  }
+}
+
+bool pulsation::StaticCache::watch_tree(const std::string& rel) {
+  std::string path = dir + rel;
+  int wd = inotify_add_watch(inotify_fd, path.c_str(), STATIC_CACHE_WATCH_MASK | IN_ONLYDIR);
+  if (wd < 0) {
+    // 目录在加入监听前已被删除
+    return errno == ENOENT || errno == ENOTDIR;
+  }
+  watches[wd] = rel;
+  DIR* d = opendir(path.c_str());
+  if (d == nullptr) {
+    return true;
+  }
+  bool ok = true;
+  while (struct dirent* entry = readdir(d)) {
+    std::string_view name(entry->d_name);
+    if (name == "." || name == "..") {
+      continue;
+    }
+    bool is_dir = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_UNKNOWN) {
+      struct stat st;
+      is_dir = lstat((path + "/" + entry->d_name).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    if (is_dir && !watch_tree(rel + "/" + entry->d_name)) {
+      ok = false;
+      break;
+    }
+  }
+  closedir(d);
+  return ok;
+}
+
+void pulsation::StaticCache::run() {
+  alignas(struct inotify_event) char buffer[16 * 1024];
+  time_t swept = 0;
+  while (!stopping.load()) {
+    time_t now = Clock::now();
+    if (now != swept) {
+      evict_idle(now);
+      swept = now;
+    }
+    struct pollfd pfd{inotify_fd, POLLIN, 0};
+    if (poll(&pfd, 1, STATIC_CACHE_POLL_MS) <= 0) {
+      continue;
+    }
+    ssize_t size = read(inotify_fd, buffer, sizeof(buffer));
+    if (size <= 0) {
+      continue;
+    }
+    for (char* p = buffer; p < buffer + size; ) {
+      struct inotify_event* event = reinterpret_cast<struct inotify_event*>(p);
+      p += sizeof(struct inotify_event) + event->len;
+      if (event->mask & IN_Q_OVERFLOW) {
+        // 丢失了事件，无法知道哪些条目过期
+        clear();
+        continue;
+      }
+      if (event->mask & IN_IGNORED) {
+        watches.erase(event->wd);
+        continue;
+      }
+      auto it = watches.find(event->wd);
+      if (it == watches.end()) {
+        continue;
+      }
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+        clear();
+        continue;
+      }
+      std::string key = it->second + "/" + (event->len > 0 ? event->name : "");
+      if (event->mask & IN_ISDIR) {
+        // 目录的增删与移动很少见，整体清空，包括其下缓存的不存在路径
+        if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && !watch_tree(key)) {
+          perror("Error watch static dir, static file cache disabled");
+          watching.store(false);
+        }
+        clear();
+        continue;
+      }
+      invalidate(key);
+      for (Encoding encoding : sidecar_encodings) {
+        std::string_view suffix = encoding_suffix(encoding);
+        if (ends_with(key, suffix)) {
+          invalidate(std::string_view(key).substr(0, key.size() - suffix.size()));
+        }
+      }
+    }
+  }
+}
+
+pulsation::StaticCacheStats pulsation::StaticCache::stats() {
+  StaticCacheStats result{hit_count.load(), miss_count.load(), eviction_count.load(), invalidation_count.load(), 0, 0, 0};
+  for (Shard& shard : shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    result.entries += shard.index.size();
+    result.bytes += shard.bytes;
+    result.mappings += shard.mappings;
+  }
+  return result;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <cstdint>
+#include <ctime>
+#include <string_view>
+#include <unordered_map>
+#include "connection.h"
+
+namespace pulsation {
+  #define STATIC_CACHE_SHARDS 16
+  #define STATIC_CACHE_BYTES (64 * 1024 * 1024)
+  #define STATIC_CACHE_MAX_MAPPINGS 4096      // 缓存持有的映射数上限；映射的页属于页缓存，不计入STATIC_CACHE_BYTES
+  #define STATIC_CACHE_ENTRY_OVERHEAD 256     // 每个条目（包括不存在的路径）额外计入的字节数
+  #define STATIC_MMAP_MIN_SIZE (16 * 1024)    // 小文件映射的页对齐与建立映射的开销不划算，读入内存
+  #define STATIC_MMAP_IDLE_SECONDS 60         // 映射的文件超过该时间没有被请求时从缓存中移除并解除映射
+  /**
+   * 静态文件的内容与元数据，缓存后只读，多个请求共用。
+   * 较大的文件为MAP_SHARED的只读映射，页缓存是唯一的一份数据，Slice的引用计数归零（缓存与请求都不再使用）时解除映射。
+   * 映射期间文件被原地截断后，在用户态访问截断部分会产生SIGBUS，需要读取内容时用copy_mapped拷贝；
+   * 发送由内核拷贝，截断时writev返回EFAULT，只关闭该连接。更新静态文件应写入临时文件后rename（pulsation-precompress即如此）
+   **/
+  struct StaticFile {
+    Slice body;
+    std::string type;   // 按扩展名得到的content-type
+    size_t size;
+    time_t mtime;
+    std::string etag;   // "mtime-size"（十六进制），与nginx相同
+    unsigned encodings = 0;  // 存在不旧于原文件的预压缩旁路文件的编码（encoding_bit的组合）
+    Slice encoded[4];        // 旁路文件的内容，下标为Encoding
+    unsigned mappings = 0;   // 原文件与旁路文件中映射的个数
+    size_t mapped_bytes = 0; // 映射的字节数
+  };
+  /**
+   * 在用户态拷贝可能来自文件映射的数据到out，映射的文件被截断时返回false而不是因SIGBUS退出。
+   * 只在拷贝期间捕获SIGBUS，其余时候的SIGBUS仍按原来的方式处理
+   **/
+  bool copy_mapped(const Slice& data, std::string& out);
+  // If-None-Match是否匹配etag（弱比较），支持逗号分隔的多个值与*
+  bool etag_match(std::string_view if_none_match, std::string_view etag);
+  struct StaticCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;
+    uint64_t entries;
+    uint64_t bytes;
+    uint64_t mappings;
+  };
+  /**
+   * 静态目录的文件缓存，命中时不做任何文件系统调用。
+   * key为规范化后的请求路径，不存在或不能访问的路径也缓存（值为空），按key分片，每个分片一把锁与一条LRU，
+   * 按读入内存的字节数与映射数两种容量淘汰。
+   * 后台线程用inotify监听目录树，文件变化时删除对应条目（包括旁路文件对应的原文件），
+   * 目录增删或事件队列溢出时清空。inotify不可用时不缓存，每次都从磁盘读取。
+   * 指向目录外的符号链接，其目标的修改不会被发现。
+   **/
+  class StaticCache {
+    private:
+      struct Entry {
+        std::string key;
+        std::shared_ptr<const StaticFile> file; // 为空表示不是可访问的文件
+        size_t bytes;       // 计入容量的字节数，不含映射
+        time_t last_used;
+      };
+      struct Shard {
+        std::mutex mutex;
+        std::list<Entry> entries; // 最近使用的在前
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+        size_t mappings = 0;
+        uint64_t generation = 0;  // 每次删除条目时加1，读盘期间发生变化则不写入，避免写入过期内容
+      };
+      std::string dir;
+      std::string root;  // dir的真实路径，用于检查符号链接是否指向目录外
+      Shard shards[STATIC_CACHE_SHARDS];
+      size_t shard_capacity;
+      int inotify_fd = -1;
+      std::unordered_map<int, std::string> watches; // wd -> 相对dir的目录，只由监听线程访问
+      std::atomic<bool> watching{false}; // 为false时不写入缓存
+      std::atomic<bool> stopping{false};
+      std::thread watcher;
+      std::atomic<uint64_t> hit_count{0};
+      std::atomic<uint64_t> miss_count{0};
+      std::atomic<uint64_t> eviction_count{0};
+      std::atomic<uint64_t> invalidation_count{0};
+
+      Shard& shard_of(std::string_view key);
+      std::shared_ptr<const StaticFile> load(const std::string& key);
+      void erase(Shard& shard, std::list<Entry>::iterator it);
+      void insert(Shard& shard, uint64_t generation, const std::string& key, const std::shared_ptr<const StaticFile>& file);
+      bool watch_tree(const std::string& rel);
+      void run();
+      void invalidate(std::string_view key);
+      void clear();
+      void evict_idle(time_t now);
+    public:
+      explicit StaticCache(const std::string& dir, size_t max_bytes = STATIC_CACHE_BYTES);
+      ~StaticCache();
+      StaticCache(const StaticCache&) = delete;
+      StaticCache& operator=(const StaticCache&) = delete;
+      // path为请求路径，如"/index.html"；不是dir下的普通文件时返回nullptr
+      std::shared_ptr<const StaticFile> get(std::string_view path);
+      StaticCacheStats stats();
+  };
+}
@@ -0,0 +1,135 @@
+/**
+ * HTTP/2错误响应测试：带END_STREAM的HEADERS解码后超过header列表上限，
+ * 流在发出431后即被关闭并删除，之后不能再访问该流；同一连接上的后续请求照常处理。
+ **/
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "server.h"
+#include "http2.h"
+
+#define TEST_PORT 18932
+#define TEST_TIMEOUT_MS 5000
+
+namespace {
+  std::string frame(uint8_t type, uint8_t flags, uint32_t stream_id, const std::string& payload) {
+    std::string out;
+    out.push_back(static_cast<char>(payload.size() >> 16));
+    out.push_back(static_cast<char>(payload.size() >> 8));
+    out.push_back(static_cast<char>(payload.size()));
+    out.push_back(static_cast<char>(type));
+    out.push_back(static_cast<char>(flags));
+    out.push_back(static_cast<char>(stream_id >> 24));
+    out.push_back(static_cast<char>(stream_id >> 16));
+    out.push_back(static_cast<char>(stream_id >> 8));
+    out.push_back(static_cast<char>(stream_id));
+    return out + payload;
+  }
+
+  // GET http / ，authority为localhost
+  std::string request_head() {
+    return std::string("\x82\x86\x84\x41\x09localhost", 14);
+  }
+
+  // 加入动态表的大字段，之后每个0xbe字节都引用它，解码后的列表远超HPACK_MAX_LIST_SIZE
+  std::string bomb_head() {
+    std::string block = request_head();
+    std::string value(4000, 'a');
+    block += std::string("\x40\x06x-bomb\x7f", 9);
+    size_t rest = value.size() - 127;
+    while (rest >= 128) {
+      block.push_back(static_cast<char>((rest & 0x7f) | 0x80));
+      rest >>= 7;
+    }
+    block.push_back(static_cast<char>(rest));
+    block += value;
+    block += std::string(200, '\xbe');
+    return block;
+  }
+
+  // 读取帧直到stream_id上的流结束，返回该流HEADERS的header block
+  bool read_stream(int fd, std::string& buffer, uint32_t stream_id, std::string& headers) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TEST_TIMEOUT_MS);
+    char buf[65536];
+    while (1) {
+      while (buffer.size() >= 9) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(buffer.data());
+        size_t length = (size_t(p[0]) << 16) | (size_t(p[1]) << 8) | p[2];
+        if (buffer.size() < 9 + length) {
+          break;
+        }
+        uint8_t type = p[3];
+        uint8_t flags = p[4];
+        uint32_t id = ((uint32_t(p[5]) << 24) | (uint32_t(p[6]) << 16) | (uint32_t(p[7]) << 8) | p[8]) & 0x7fffffff;
+        std::string payload = buffer.substr(9, length);
+        buffer.erase(0, 9 + length);
+        if (id != stream_id) {
+          continue;
+        }
+        if (type == 0x1) {
+          headers += payload;
+        }
+        if (type == 0x3 || ((type == 0x0 || type == 0x1) && (flags & 0x1))) {
+          return true;
+        }
+      }
+      int left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+      struct pollfd pfd{fd, POLLIN, 0};
+      if (left <= 0 || poll(&pfd, 1, left) <= 0) {
+        return false;
+      }
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n <= 0) {
+        return false;
+      }
+      buffer.append(buf, n);
+    }
+  }
+}
+
+int main() {
+  pulsation::Server server{TEST_PORT, 1};
+  server.use([](pulsation::FilterProperties&, pulsation::Context& ctx, pulsation::NextFunc) {
+    ctx.response.status_code = "200";
+    ctx.response.body = "ok";
+    ctx.end();
+  });
+  std::thread([&server] { server.run(); }).detach();
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(TEST_PORT);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0) {
+    perror("connect");
+    _exit(1);
+  }
+  // 流1：超大header block，END_STREAM | END_HEADERS；流3：正常请求
+  std::string requests = std::string(H2_PREFACE, H2_PREFACE_SIZE) + frame(0x4, 0, 0, "") +
+    frame(0x1, 0x5, 1, bomb_head()) + frame(0x1, 0x5, 3, request_head());
+  if (write(fd, requests.data(), requests.size()) != static_cast<ssize_t>(requests.size())) {
+    perror("write");
+    _exit(1);
+  }
+  std::string buffer, headers;
+  if (!read_stream(fd, buffer, 1, headers) || headers.find("431") == std::string::npos) {
+    fprintf(stderr, "FAIL: oversized header block was not answered with 431\n");
+    _exit(1);
+  }
+  headers.clear();
+  // :status 200在静态表中，编码为0x88
+  if (!read_stream(fd, buffer, 3, headers) || headers.empty() || headers[0] != '\x88') {
+    fprintf(stderr, "FAIL: request after the oversized header block failed\n");
+    _exit(1);
+  }
+  printf("OK\n");
+  fflush(stdout);
+  _exit(0);
+}
@@ -0,0 +1,130 @@
+/**
+ * 流水线背压测试：第一个请求流式响应且晚于第二个请求完成，第二个请求的响应超过高水位。
+ * 第二个响应在重排缓冲中等待时不能计入第一个响应的背压，否则两者互相等待直到连接超时。
+ **/
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "server.h"
+
+#define TEST_PORT 18931
+#define TEST_TIMEOUT_MS 10000
+#define STREAM_CHUNK (64 * 1024)
+#define STREAM_CHUNKS 32
+#define BIG_BODY_SIZE (2 * 1024 * 1024)
+
+namespace {
+  // 第二个响应（content-length）是否已完整收到
+  bool received_all(const std::string& data) {
+    size_t head = data.find("content-length: " + std::to_string(BIG_BODY_SIZE));
+    if (head == std::string::npos) {
+      return false;
+    }
+    size_t head_end = data.find("\r\n\r\n", head);
+    return head_end != std::string::npos && data.size() >= head_end + 4 + BIG_BODY_SIZE;
+  }
+
+  // 读到两个响应都完整或超时
+  bool read_responses(int fd, std::string& out) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TEST_TIMEOUT_MS);
+    char buf[65536];
+    while (!received_all(out)) {
+      int left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+      struct pollfd pfd{fd, POLLIN, 0};
+      if (left <= 0 || poll(&pfd, 1, left) <= 0) {
+        return false;
+      }
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n <= 0) {
+        return false;
+      }
+      out.append(buf, n);
+    }
+    return true;
+  }
+
+  // 解析chunked body，返回解码后的数据，格式错误时返回false
+  bool decode_chunked(const std::string& data, size_t& pos, std::string& body) {
+    while (1) {
+      size_t line_end = data.find("\r\n", pos);
+      if (line_end == std::string::npos) {
+        return false;
+      }
+      size_t size = std::stoul(data.substr(pos, line_end - pos), nullptr, 16);
+      pos = line_end + 2;
+      if (size == 0) {
+        pos += 2;
+        return true;
+      }
+      body.append(data, pos, size);
+      pos += size + 2;
+    }
+  }
+}
+
+int main() {
+  pulsation::Server server{TEST_PORT, 2};
+  server.use([](pulsation::FilterProperties&, pulsation::Context& ctx, pulsation::NextFunc) {
+    if (ctx.request.path() == "/stream") {
+      // 等第二个请求先完成并进入重排缓冲
+      std::this_thread::sleep_for(std::chrono::milliseconds(300));
+      for (int i = 0; i < STREAM_CHUNKS; ++i) {
+        if (!ctx.write(std::string(STREAM_CHUNK, 'a'))) {
+          return;
+        }
+      }
+    } else {
+      ctx.response.status_code = "200";
+      ctx.response.body = std::string(BIG_BODY_SIZE, 'b');
+    }
+    ctx.end();
+  });
+  std::thread([&server] { server.run(); }).detach();
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(TEST_PORT);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0) {
+    perror("connect");
+    _exit(1);
+  }
+  std::string requests = "GET /stream HTTP/1.1\r\nHost: test\r\n\r\nGET /big HTTP/1.1\r\nHost: test\r\n\r\n";
+  if (write(fd, requests.data(), requests.size()) != static_cast<ssize_t>(requests.size())) {
+    perror("write");
+    _exit(1);
+  }
+  std::string data;
+  if (!read_responses(fd, data)) {
+    fprintf(stderr, "FAIL: timed out after %zu bytes, connection stalled\n", data.size());
+    _exit(1);
+  }
+  size_t pos = data.find("\r\n\r\n");
+  std::string stream_body;
+  if (pos == std::string::npos || data.find("transfer-encoding: chunked") > pos) {
+    fprintf(stderr, "FAIL: first response is not chunked\n");
+    _exit(1);
+  }
+  pos += 4;
+  if (!decode_chunked(data, pos, stream_body) || stream_body != std::string(STREAM_CHUNK * STREAM_CHUNKS, 'a')) {
+    fprintf(stderr, "FAIL: streamed response corrupted\n");
+    _exit(1);
+  }
+  size_t head_end = data.find("\r\n\r\n", pos);
+  if (head_end == std::string::npos || data.size() - head_end - 4 != BIG_BODY_SIZE ||
+      data.compare(head_end + 4, BIG_BODY_SIZE, std::string(BIG_BODY_SIZE, 'b')) != 0) {
+    fprintf(stderr, "FAIL: second response corrupted\n");
+    _exit(1);
+  }
+  // 服务线程已分离且不会退出，直接结束进程
+  printf("OK\n");
+  fflush(stdout);
+  _exit(0);
+}
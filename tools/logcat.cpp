@@ -0,0 +1,122 @@
+// pulsation-logcat: 把二进制访问日志解码为文本或JSON
+// 用法: pulsation-logcat [--json] access.log [access.log.1 ...]
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "../binlog.h"
+
+using namespace pulsation;
+
+static std::string json_escape(const std::string& s) {
+  std::string out;
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+static bool decode(const std::string& file, bool json) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in) {
+    std::cerr << "pulsation-logcat: cannot open " << file << std::endl;
+    return false;
+  }
+  std::stringstream s_file;
+  s_file << in.rdbuf();
+  std::string data = s_file.str();
+  BinlogHeader header;
+  if (data.size() < sizeof(header)) {
+    std::cerr << "pulsation-logcat: " << file << " is too short" << std::endl;
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  if (memcmp(header.magic, BINLOG_MAGIC, 4) != 0 || header.version != BINLOG_VERSION) {
+    std::cerr << "pulsation-logcat: " << file << " is not a pulsation binary log" << std::endl;
+    return false;
+  }
+  std::vector<std::string> paths;
+  size_t offset = sizeof(header);
+  while (offset + 8 <= data.size()) {
+    uint8_t kind = static_cast<uint8_t>(data[offset]);
+    if (kind == BINLOG_END) {
+      break;
+    }
+    if (kind == BINLOG_PATH) {
+      BinlogPath entry;
+      memcpy(&entry, data.data() + offset, sizeof(entry));
+      size_t size = sizeof(entry) + ((entry.size + 7) & ~size_t(7));
+      if (offset + size > data.size()) {
+        break;
+      }
+      if (entry.id >= paths.size()) {
+        paths.resize(entry.id + 1);
+      }
+      paths[entry.id].assign(data.data() + offset + sizeof(entry), entry.size);
+      offset += size;
+      continue;
+    }
+    if (kind != BINLOG_ACCESS || offset + sizeof(BinlogAccess) > data.size()) {
+      std::cerr << "pulsation-logcat: " << file << " is corrupted at offset " << offset << std::endl;
+      return false;
+    }
+    BinlogAccess entry;
+    memcpy(&entry, data.data() + offset, sizeof(entry));
+    offset += sizeof(entry);
+    int64_t time_ms = header.base_time_ms + entry.time_delta_ms;
+    time_t seconds = time_ms / 1000;
+    struct tm tstruct;
+    localtime_r(&seconds, &tstruct);
+    char time_buf[48];
+    size_t n = strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %X", &tstruct);
+    snprintf(time_buf + n, sizeof(time_buf) - n, ".%03d", static_cast<int>(time_ms % 1000));
+    const char* method = entry.method < sizeof(binlog_methods) / sizeof(binlog_methods[0]) ? binlog_methods[entry.method] : "OTHER";
+    std::string path = entry.path_id < paths.size() ? paths[entry.path_id] : "-";
+    if (json) {
+      std::cout << "{\"time\":\"" << time_buf << "\",\"ts_ms\":" << time_ms << ",\"thread\":" << entry.thread
+        << ",\"method\":\"" << method << "\",\"path\":\"" << json_escape(path) << "\",\"status\":" << entry.status
+        << ",\"bytes\":" << entry.bytes << ",\"latency_us\":" << entry.latency_us << "}\n";
+    } else {
+      std::cout << time_buf << " [thread " << entry.thread << "] " << method << " " << path << " " << entry.status
+        << " " << entry.bytes << " " << entry.latency_us << "us\n";
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  bool json = false;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+      std::cout << "usage: pulsation-logcat [--json] file..." << std::endl;
+      return 0;
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+  if (files.empty()) {
+    std::cerr << "usage: pulsation-logcat [--json] file..." << std::endl;
+    return 2;
+  }
+  bool ok = true;
+  for (const std::string& file : files) {
+    ok = decode(file, json) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+// pulsation-precompress: 为静态目录中的可压缩文件生成最高压缩级别的.gz（及.zst、.br）旁路文件
+// 用法: pulsation-precompress [--force] ./static [dir ...]
+// static filter在客户端接受对应编码且旁路文件不旧于原文件时直接返回它
+#include <ftw.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../compress.h"
+
+using namespace pulsation;
+
+static bool force = false;
+static size_t written = 0;
+static size_t skipped = 0;
+
+// 按纳秒比较修改时间，同一秒内修改过的原文件会重新生成旁路文件
+static bool not_older(const struct stat& a, const struct stat& b) {
+  return a.st_mtim.tv_sec != b.st_mtim.tv_sec ? a.st_mtim.tv_sec > b.st_mtim.tv_sec : a.st_mtim.tv_nsec >= b.st_mtim.tv_nsec;
+}
+
+static bool has_suffix(const std::string& s, const char* suffix) {
+  size_t n = strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+static void precompress(const std::string& path, const struct stat& source) {
+  std::ifstream f(path, std::ios::binary);
+  std::stringstream s_f;
+  s_f << f.rdbuf();
+  std::string content = s_f.str();
+  if (content.size() < COMPRESS_MIN_SIZE || !looks_compressible(content)) {
+    skipped++;
+    return;
+  }
+  // 只生成编译时找到了库的编码
+  for (Encoding encoding : {Encoding::GZIP, Encoding::ZSTD, Encoding::BR}) {
+    Compressor* c = compressor(encoding);
+    if (c == nullptr) {
+      continue;
+    }
+    std::string target = path + encoding_suffix(encoding);
+    struct stat st;
+    if (!force && stat(target.c_str(), &st) == 0 && not_older(st, source)) {
+      continue;
+    }
+    std::string out;
+    if (!c->compress(content, out, c->max_level())) {
+      std::cerr << "pulsation-precompress: " << encoding_name(encoding) << " failed for " << path << std::endl;
+      continue;
+    }
+    if (out.size() >= content.size()) {
+      // 没有收益时删除旧的旁路文件，回退到运行时处理
+      unlink(target.c_str());
+      continue;
+    }
+    // 先写临时文件再改名，服务器不会读到写了一半的文件
+    std::string tmp = target + ".tmp";
+    std::ofstream o(tmp, std::ios::binary | std::ios::trunc);
+    o.write(out.data(), out.size());
+    o.close();
+    if (!o || rename(tmp.c_str(), target.c_str()) < 0) {
+      std::cerr << "pulsation-precompress: cannot write " << target << std::endl;
+      unlink(tmp.c_str());
+      continue;
+    }
+    written++;
+    std::cout << target << " " << content.size() << " -> " << out.size() << std::endl;
+  }
+}
+
+static int visit(const char* fpath, const struct stat* sb, int typeflag, struct FTW*) {
+  std::string path(fpath);
+  if (typeflag != FTW_F || has_suffix(path, ".gz") || has_suffix(path, ".zst") || has_suffix(path, ".br") || has_suffix(path, ".tmp")) {
+    return 0;
+  }
+  precompress(path, *sb);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> dirs;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--force") == 0) {
+      force = true;
+    } else {
+      dirs.push_back(argv[i]);
+    }
+  }
+  if (dirs.empty()) {
+    std::cerr << "usage: pulsation-precompress [--force] dir [dir ...]" << std::endl;
+    return 1;
+  }
+  for (const std::string& dir : dirs) {
+    if (nftw(dir.c_str(), visit, 16, FTW_PHYS) != 0) {
+      perror(dir.c_str());
+      return 1;
+    }
+  }
+  std::cout << written << " written, " << skipped << " skipped" << std::endl;
+  return 0;
+}
@@ -0,0 +1,391 @@
+#include <cstring>
+#include "websocket.h"
+#include "base64.h"
+
+namespace {
+  const char* WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+  inline uint32_t rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+  }
+
+  // 握手只需要对很短的key做一次SHA-1，不为此引入额外依赖
+  void sha1(const std::string& input, unsigned char digest[20]) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    std::string msg = input;
+    uint64_t bits = uint64_t(input.size()) * 8;
+    msg.push_back('\x80');
+    while (msg.size() % 64 != 56) {
+      msg.push_back('\0');
+    }
+    for (int i = 7; i >= 0; --i) {
+      msg.push_back(char(bits >> (i * 8)));
+    }
+    for (size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+      uint32_t w[80];
+      const unsigned char* p = reinterpret_cast<const unsigned char*>(msg.data()) + chunk;
+      for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t(p[i * 4]) << 24) | (uint32_t(p[i * 4 + 1]) << 16) | (uint32_t(p[i * 4 + 2]) << 8) | p[i * 4 + 3];
+      }
+      for (int i = 16; i < 80; ++i) {
+        w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+      }
+      uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+      for (int i = 0; i < 80; ++i) {
+        uint32_t f, k;
+        if (i < 20) {
+          f = (b & c) | (~b & d);
+          k = 0x5A827999;
+        } else if (i < 40) {
+          f = b ^ c ^ d;
+          k = 0x6ED9EBA1;
+        } else if (i < 60) {
+          f = (b & c) | (b & d) | (c & d);
+          k = 0x8F1BBCDC;
+        } else {
+          f = b ^ c ^ d;
+          k = 0xCA62C1D6;
+        }
+        uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = temp;
+      }
+      h[0] += a;
+      h[1] += b;
+      h[2] += c;
+      h[3] += d;
+      h[4] += e;
+    }
+    for (int i = 0; i < 5; ++i) {
+      digest[i * 4] = h[i] >> 24;
+      digest[i * 4 + 1] = h[i] >> 16;
+      digest[i * 4 + 2] = h[i] >> 8;
+      digest[i * 4 + 3] = h[i];
+    }
+  }
+
+  bool valid_utf8(const std::string& s) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s.data());
+    size_t n = s.size(), i = 0;
+    while (i < n) {
+      unsigned char c = p[i];
+      if (c < 0x80) {
+        i++;
+        continue;
+      }
+      size_t len;
+      uint32_t cp;
+      if ((c & 0xE0) == 0xC0) {
+        len = 2;
+        cp = c & 0x1F;
+      } else if ((c & 0xF0) == 0xE0) {
+        len = 3;
+        cp = c & 0x0F;
+      } else if ((c & 0xF8) == 0xF0) {
+        len = 4;
+        cp = c & 0x07;
+      } else {
+        return false;
+      }
+      if (i + len > n) {
+        return false;
+      }
+      for (size_t j = 1; j < len; ++j) {
+        if ((p[i + j] & 0xC0) != 0x80) {
+          return false;
+        }
+        cp = (cp << 6) | (p[i + j] & 0x3F);
+      }
+      // 过长编码、代理区与超出范围的码点
+      if ((len == 2 && cp < 0x80) || (len == 3 && cp < 0x800) || (len == 4 && cp < 0x10000) ||
+          (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
+        return false;
+      }
+      i += len;
+    }
+    return true;
+  }
+
+  pulsation::Slice close_frame(uint16_t code, const std::string& reason) {
+    std::string payload;
+    payload.push_back(char(code >> 8));
+    payload.push_back(char(code & 0xff));
+    payload.append(reason, 0, 123);
+    return pulsation::ws_frame(pulsation::WS_CLOSE, payload);
+  }
+}
+
+pulsation::Slice pulsation::ws_frame(uint8_t opcode, const char* data, size_t size) {
+  std::string frame;
+  frame.reserve(size + 10);
+  frame.push_back(char(0x80 | opcode));
+  if (size < 126) {
+    frame.push_back(char(size));
+  } else if (size <= 0xffff) {
+    frame.push_back(char(126));
+    frame.push_back(char(size >> 8));
+    frame.push_back(char(size & 0xff));
+  } else {
+    frame.push_back(char(127));
+    for (int i = 7; i >= 0; --i) {
+      frame.push_back(char(uint64_t(size) >> (i * 8)));
+    }
+  }
+  frame.append(data, size);
+  return make_slice(std::move(frame));
+}
+
+std::string pulsation::ws_accept_key(const std::string& key) {
+  unsigned char digest[20];
+  sha1(key + WS_GUID, digest);
+  return base64_encode(digest, sizeof(digest));
+}
+
+bool pulsation::WebSocket::send(const std::string& data, uint8_t opcode) {
+  return send(ws_frame(opcode, data));
+}
+
+bool pulsation::WebSocket::send(const Slice& frame) {
+  std::shared_ptr<Connection> c = conn.lock();
+  if (!c || c->closed.load() || closing.load()) {
+    return false;
+  }
+  // 广播时不能被单个慢连接拖住，积压过多直接丢弃
+  if (c->pending.load() >= HIGH_WATER_MARK) {
+    return false;
+  }
+  c->send(0, frame, false, false, MSG_WS_FRAME);
+  return true;
+}
+
+void pulsation::WebSocket::close(uint16_t code, const std::string& reason) {
+  std::shared_ptr<Connection> c = conn.lock();
+  if (!c || closing.exchange(true)) {
+    return;
+  }
+  c->send(0, close_frame(code, reason), false, false, MSG_WS_CLOSE);
+}
+
+bool pulsation::WebSocket::post(WebSocketEvent event) {
+  std::lock_guard<std::mutex> lock(mutex);
+  inbox.push_back(std::move(event));
+  if (scheduled) {
+    return false;
+  }
+  scheduled = true;
+  return true;
+}
+
+void pulsation::WebSocket::run() {
+  WebSocketPtr self = shared_from_this();
+  while (1) {
+    WebSocketEvent event;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (inbox.empty()) {
+        scheduled = false;
+        return;
+      }
+      event = std::move(inbox.front());
+      inbox.pop_front();
+    }
+    try {
+      if (event.type == WebSocketEvent::OPEN) {
+        if (handler.on_open) handler.on_open(self);
+      } else if (event.type == WebSocketEvent::MESSAGE) {
+        if (handler.on_message) handler.on_message(self, event.opcode, event.data);
+      } else {
+        closing.store(true);
+        if (handler.on_close) handler.on_close(self, event.code);
+      }
+    } catch (...) {
+      close(1011);
+    }
+  }
+}
+
+size_t pulsation::broadcast(const std::vector<WebSocketPtr>& targets, uint8_t opcode, const std::string& data) {
+  Slice frame = ws_frame(opcode, data);
+  size_t count = 0;
+  for (const WebSocketPtr& ws : targets) {
+    if (ws->send(frame)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+pulsation::WebSocketSession::WebSocketSession(size_t max_message, EmitFunc emit, DispatchFunc dispatch):
+  max_message(max_message), emit(std::move(emit)), dispatch(std::move(dispatch)), last_seen(time(0)) {}
+
+void pulsation::WebSocketSession::open() {
+  dispatch(WebSocketEvent{WebSocketEvent::OPEN, 0, "", 0});
+}
+
+bool pulsation::WebSocketSession::feed(std::string& content) {
+  last_seen = time(0);
+  ping_pending = false;
+  size_t offset = 0;
+  bool ok = true;
+  while (ok && !close_received) {
+    size_t avail = content.size() - offset;
+    if (avail < 2) {
+      break;
+    }
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(content.data()) + offset;
+    bool fin = p[0] & 0x80;
+    uint8_t opcode = p[0] & 0x0f;
+    uint64_t length = p[1] & 0x7f;
+    size_t header = 2;
+    if (length == 126) {
+      if (avail < 4) break;
+      length = (uint64_t(p[2]) << 8) | p[3];
+      header = 4;
+    } else if (length == 127) {
+      if (avail < 10) break;
+      length = 0;
+      for (int i = 0; i < 8; ++i) {
+        length = (length << 8) | p[2 + i];
+      }
+      header = 10;
+    }
+    // 客户端帧必须加掩码，未协商扩展时RSV位必须为0
+    if ((p[0] & 0x70) || !(p[1] & 0x80)) {
+      ok = fail(1002);
+      break;
+    }
+    if ((opcode & 0x08) && (!fin || length > 125)) {
+      ok = fail(1002);
+      break;
+    }
+    if (length > max_message || message.size() + length > max_message) {
+      ok = fail(1009);
+      break;
+    }
+    if (avail < header + 4 + length) {
+      break;
+    }
+    const uint8_t* mask = p + header;
+    const uint8_t* data = mask + 4;
+    std::string payload(length, '\0');
+    for (size_t i = 0; i < length; ++i) {
+      payload[i] = char(data[i] ^ mask[i & 3]);
+    }
+    offset += header + 4 + length;
+    ok = handle_frame(fin, opcode, payload);
+  }
+  content.erase(0, offset);
+  if (close_received) {
+    // 关闭握手之后的数据没有意义
+    content.clear();
+  }
+  return ok;
+}
+
+bool pulsation::WebSocketSession::handle_frame(bool fin, uint8_t opcode, std::string& payload) {
+  switch (opcode) {
+    case WS_CONTINUATION:
+      if (message_opcode == 0) {
+        return fail(1002);
+      }
+      message.append(payload);
+      if (fin) {
+        if (message_opcode == WS_TEXT && !valid_utf8(message)) {
+          return fail(1007);
+        }
+        dispatch(WebSocketEvent{WebSocketEvent::MESSAGE, message_opcode, std::move(message)});
+        message.clear();
+        message_opcode = 0;
+      }
+      return true;
+    case WS_TEXT:
+    case WS_BINARY:
+      if (message_opcode != 0) {
+        return fail(1002);
+      }
+      if (!fin) {
+        message_opcode = opcode;
+        message = std::move(payload);
+        return true;
+      }
+      if (opcode == WS_TEXT && !valid_utf8(payload)) {
+        return fail(1007);
+      }
+      dispatch(WebSocketEvent{WebSocketEvent::MESSAGE, opcode, std::move(payload)});
+      return true;
+    case WS_CLOSE: {
+      uint16_t code = 1005;
+      if (payload.size() == 1) {
+        return fail(1002);
+      }
+      if (payload.size() >= 2) {
+        code = (uint16_t(uint8_t(payload[0])) << 8) | uint8_t(payload[1]);
+        if (code < 1000 || code == 1004 || code == 1005 || code == 1006 || code == 1015 || (code > 1015 && code < 3000) || code >= 5000 ||
+            !valid_utf8(payload.substr(2))) {
+          return fail(1002);
+        }
+      }
+      close_received = true;
+      notify_close(code);
+      if (!close_sent) {
+        // 回应关闭帧，写完后关闭连接
+        close_sent = true;
+        emit(close_frame(code == 1005 ? 1000 : code, ""), false, true);
+        return true;
+      }
+      return false;
+    }
+    case WS_PING:
+      emit(ws_frame(WS_PONG, payload), false, false);
+      return true;
+    case WS_PONG:
+      return true;
+    default:
+      return fail(1002);
+  }
+}
+
+bool pulsation::WebSocketSession::fail(uint16_t code) {
+  notify_close(code);
+  if (!close_sent) {
+    close_sent = true;
+    emit(close_frame(code, ""), false, true);
+  }
+  return false;
+}
+
+void pulsation::WebSocketSession::notify_close(uint16_t code) {
+  if (close_dispatched) {
+    return;
+  }
+  close_dispatched = true;
+  dispatch(WebSocketEvent{WebSocketEvent::CLOSE, 0, "", code});
+}
+
+void pulsation::WebSocketSession::on_message(Message& msg) {
+  if (close_sent || (msg.type != MSG_WS_FRAME && msg.type != MSG_WS_CLOSE)) {
+    msg.conn->consumed(msg.data.size);
+    return;
+  }
+  if (msg.type == MSG_WS_CLOSE) {
+    // 等待对端回应关闭帧后再关闭连接
+    close_sent = true;
+  }
+  emit(std::move(msg.data), true, false);
+}
+
+bool pulsation::WebSocketSession::ping() {
+  if (ping_pending || close_sent) {
+    return false;
+  }
+  ping_pending = true;
+  emit(ws_frame(WS_PING, nullptr, 0), false, false);
+  return true;
+}
+
+void pulsation::WebSocketSession::closed() {
+  notify_close(1006);
+}
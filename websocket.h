@@ -0,0 +1,117 @@
+#pragma once
+#include <any>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include "connection.h"
+
+namespace pulsation {
+  #define WS_MAX_MESSAGE_SIZE (16 * 1024 * 1024)
+  #define WS_PING_INTERVAL 30
+  enum WsOpcode : uint8_t {
+    WS_CONTINUATION = 0x0,
+    WS_TEXT = 0x1,
+    WS_BINARY = 0x2,
+    WS_CLOSE = 0x8,
+    WS_PING = 0x9,
+    WS_PONG = 0xA
+  };
+  // IO线程交给worker的事件
+  struct WebSocketEvent {
+    enum Type : uint8_t { OPEN, MESSAGE, CLOSE } type;
+    uint8_t opcode = 0;   // MESSAGE: WS_TEXT或WS_BINARY
+    std::string data;
+    uint16_t code = 0;    // CLOSE: 关闭码，连接异常断开时为1006
+  };
+
+  class WebSocket;
+  typedef std::shared_ptr<WebSocket> WebSocketPtr;
+  struct WebSocketHandler {
+    std::function<void(const WebSocketPtr&)> on_open;
+    std::function<void(const WebSocketPtr&, uint8_t opcode, std::string& data)> on_message;
+    std::function<void(const WebSocketPtr&, uint16_t code)> on_close;
+  };
+
+  // 序列化一个服务端帧（不加掩码），广播时只序列化一次，各连接共享同一个Slice
+  Slice ws_frame(uint8_t opcode, const char* data, size_t size);
+  inline Slice ws_frame(uint8_t opcode, const std::string& data) {
+    return ws_frame(opcode, data.data(), data.size());
+  }
+  // Sec-WebSocket-Accept
+  std::string ws_accept_key(const std::string& key);
+
+  /**
+   * worker侧的WebSocket连接。
+   * 同一连接的事件按到达顺序串行交给handler，不会在多个worker中并发执行；
+   * send不阻塞，可以在任意线程中调用。
+   **/
+  class WebSocket : public std::enable_shared_from_this<WebSocket> {
+    private:
+      std::weak_ptr<Connection> conn;
+      WebSocketHandler handler;
+      std::mutex mutex;
+      std::deque<WebSocketEvent> inbox;
+      bool scheduled = false;
+      std::atomic<bool> closing{false};
+    public:
+      // 连接级别的用户数据，只应在handler中访问
+      std::unordered_map<std::string, std::any> extra;
+
+      WebSocket(std::weak_ptr<Connection> conn, WebSocketHandler handler): conn(conn), handler(std::move(handler)) {}
+      // 发送队列超过高水位（慢消费者）或连接已关闭时丢弃并返回false
+      bool send(const std::string& data, uint8_t opcode = WS_TEXT);
+      bool send(const Slice& frame);
+      // 发起关闭握手
+      void close(uint16_t code = 1000, const std::string& reason = "");
+      // IO线程投递事件，返回true时需要把该连接交给worker执行run
+      bool post(WebSocketEvent event);
+      // worker中依次处理积压的事件
+      void run();
+  };
+  // 同一帧发给多个连接，返回成功发送的连接数
+  size_t broadcast(const std::vector<WebSocketPtr>& targets, uint8_t opcode, const std::string& data);
+
+  /**
+   * IO线程中升级后的连接：解析客户端帧、去掩码、重组分片，
+   * 自行回复ping与关闭握手，完整的消息作为事件交给worker。
+   **/
+  class WebSocketSession {
+    public:
+      // 写出数据，counted为true表示已计入连接的pending字节数，close为true时写完后关闭连接
+      typedef std::function<void(Slice, bool, bool)> EmitFunc;
+      typedef std::function<void(WebSocketEvent&&)> DispatchFunc;
+    private:
+      size_t max_message;
+      EmitFunc emit;
+      DispatchFunc dispatch;
+      uint8_t message_opcode = 0; // 正在接收的分片消息
+      std::string message;
+      bool close_sent = false;
+      bool close_received = false;
+      bool close_dispatched = false;
+      bool ping_pending = false;
+
+      bool handle_frame(bool fin, uint8_t opcode, std::string& payload);
+      bool fail(uint16_t code);
+      void notify_close(uint16_t code);
+    public:
+      time_t last_seen;
+
+      WebSocketSession(size_t max_message, EmitFunc emit, DispatchFunc dispatch);
+      void open();
+      // 消费收到的数据，返回false表示连接应在写完后关闭
+      bool feed(std::string& content);
+      // worker发来的帧
+      void on_message(Message& msg);
+      // 空闲时探测对端，已有未回复的ping时返回false
+      bool ping();
+      // 连接断开，未完成关闭握手时通知handler
+      void closed();
+  };
+}
@@ -6,13 +6,20 @@
 #include <thread>
 #include "worker.h"
 
-pulsation::Worker::Worker(moodycamel::ConcurrentQueue<HTTPRequest>* queue, vector<Filter>* filters): queue(queue), filters(filters) {}
+pulsation::Worker::Worker(moodycamel::ConcurrentQueue<HTTPRequest>* queue, moodycamel::ConcurrentQueue<WebSocketPtr>* ws_queue, vector<Filter>* filters):
+  queue(queue), ws_queue(ws_queue), filters(filters) {}
 void pulsation::Worker::process() {
   HTTPRequest req;
+  WebSocketPtr ws;
   while (1) {
+    // WebSocket消息，同一连接的消息按顺序处理
+    if ((*ws_queue).try_dequeue(ws)) {
+      ws->run();
+      ws.reset();
+    }
     if ((*queue).try_dequeue(req)) {
       HTTPResponse response;
-      Context ctx{req.epoll_fd, req.fd, req, response};
+      Context ctx{req.epoll_fd, req.fd, req, response, {}};
       std::vector<Filter>::reverse_iterator f_iter = (*filters).rbegin();
       while (f_iter != (*filters).rend()) {
         if (f_iter == (*filters).rbegin()) {
@@ -6,9 +6,10 @@ namespace pulsation {
   class Worker {
     private:
       moodycamel::ConcurrentQueue<HTTPRequest>* queue;
+      moodycamel::ConcurrentQueue<WebSocketPtr>* ws_queue;
       vector<Filter>* filters;
     public:
-      Worker(moodycamel::ConcurrentQueue<HTTPRequest>* queue, vector<Filter>* filters);
+      Worker(moodycamel::ConcurrentQueue<HTTPRequest>* queue, moodycamel::ConcurrentQueue<WebSocketPtr>* ws_queue, vector<Filter>* filters);
       void process();
 
   };
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+namespace pulsation {
+  // XXH64（https://github.com/Cyan4973/xxHash），用于按内容索引缓存，不用于安全场景
+  namespace xxh64_detail {
+    constexpr uint64_t P1 = 11400714785074694791ULL;
+    constexpr uint64_t P2 = 14029467366897019727ULL;
+    constexpr uint64_t P3 = 1609587929392839161ULL;
+    constexpr uint64_t P4 = 9650029242287828579ULL;
+    constexpr uint64_t P5 = 2870177450012600261ULL;
+    inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    inline uint64_t read64(const unsigned char* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+    inline uint32_t read32(const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+    inline uint64_t round(uint64_t acc, uint64_t input) {
+      acc += input * P2;
+      acc = rotl(acc, 31);
+      return acc * P1;
+    }
+    inline uint64_t merge(uint64_t acc, uint64_t val) {
+      acc ^= round(0, val);
+      return acc * P1 + P4;
+    }
+  }
+
+  inline uint64_t xxhash64(const void* data, size_t size, uint64_t seed = 0) {
+    using namespace xxh64_detail;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    uint64_t h;
+    if (size >= 32) {
+      uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+      const unsigned char* limit = end - 32;
+      do {
+        v1 = round(v1, read64(p));
+        v2 = round(v2, read64(p + 8));
+        v3 = round(v3, read64(p + 16));
+        v4 = round(v4, read64(p + 24));
+        p += 32;
+      } while (p <= limit);
+      h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+      h = merge(h, v1);
+      h = merge(h, v2);
+      h = merge(h, v3);
+      h = merge(h, v4);
+    } else {
+      h = seed + P5;
+    }
+    h += size;
+    while (p + 8 <= end) {
+      h ^= round(0, read64(p));
+      h = rotl(h, 27) * P1 + P4;
+      p += 8;
+    }
+    if (p + 4 <= end) {
+      h ^= static_cast<uint64_t>(read32(p)) * P1;
+      h = rotl(h, 23) * P2 + P3;
+      p += 4;
+    }
+    while (p < end) {
+      h ^= (*p) * P5;
+      h = rotl(h, 11) * P1;
+      p++;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+  }
+}